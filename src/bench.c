@@ -0,0 +1,56 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <stdio.h>
+
+#include <utils/bench.h>
+#include <utils/misc.h>
+#include <utils/intern.h>
+#include <utils/map.h>
+
+#include <frontend/lexer.h>
+#include <frontend/parser.h>
+#include <frontend/direct-parse.h>
+#include <frontend/parallel-parse.h>
+
+#include <visitors/type-check.h>
+
+bench_def_t benches[] = {
+	{ "hash",   hash_bench },
+	{ "intern", intern_bench },
+	{ "intern (threaded)", intern_mt_bench },
+	{ "map",    map_bench },
+	{ "utf8",   scan_utf8_bench },
+	{ "lexer",  lexer_bench },
+	{ "numbers", lexer_number_bench },
+	{ "parser", parser_bench },
+	{ "direct parse", parse_direct_bench },
+	{ "type table", type_table_bench },
+	{ "scopes", scope_bench },
+	{ "type check", type_check_bench },
+	{ "inference", infer_bench },
+	{ "deep nesting", ast_nesting_bench },
+	{ "parallel parse", parse_parallel_bench },
+	{ NULL }
+};
+
+int main() {
+	log_level_filter = LOG_WARN;
+	return bench_run(benches);
+}
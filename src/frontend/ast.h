@@ -19,16 +19,28 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include <utils/misc.h>
 #include <utils/buffer.h>
+#include <utils/arena.h>
+#include <utils/map.h>
+#include <utils/strbuf.h>
 
 #include <frontend/parser.h>
+#include <frontend/symbols.h>
+
+// Types of expressions, filled in by the type checker, live until code generation is done.
+// Every thread has its own, threads building parts of the AST merge theirs into the main thread's.
+_Thread_local arena_t type_arena = { 0 };
 
 typedef enum type_kind {
 	TYPE_INTEGER,
+	TYPE_FLOAT,
 	
 	TYPE_I8,
 	TYPE_U8,
@@ -42,13 +54,19 @@ typedef enum type_kind {
 	TYPE_I64,
 	TYPE_U64,
 
+	TYPE_F32,
+	TYPE_F64,
+
 	TYPE_BOOL,
 	TYPE_VOID,
 
 	TYPE_POINTER,
 	TYPE_ARRAY,
 
-	TYPE_RECORD
+	TYPE_RECORD,
+
+	// Type variable number count, only made and resolved by the type checker
+	TYPE_VAR
 } type_kind_t;
 
 char *type_str[] = {
@@ -60,6 +78,8 @@ char *type_str[] = {
 	[TYPE_I32]  = "int",
 	[TYPE_U64]  = "unsigned long long",
 	[TYPE_I64]  = "long long",
+	[TYPE_F32]  = "float",
+	[TYPE_F64]  = "double",
 	[TYPE_BOOL] = "int",
 	[TYPE_VOID] = "void"
 };
@@ -73,21 +93,31 @@ char *type_str_lang[] = {
 	[TYPE_I32] = "I32",
 	[TYPE_U64] = "U64",
 	[TYPE_I64] = "I64",
+	[TYPE_F32] = "F32",
+	[TYPE_F64] = "F64",
 
 	[TYPE_INTEGER] = "{Integer}",
+	[TYPE_FLOAT] = "{Float}",
 
 	[TYPE_BOOL] = "Bool",
 	[TYPE_VOID] = "Void",
+
+	[TYPE_VAR] = "{Unknown}",
 };
 
 typedef struct type {
 	type_kind_t kind;
 
-	size_t count;
+	// Length of an array, number of a type variable
+	uint32_t count;
 	union {
 		struct type *child;
 		char *record;
 	};
+
+	// Canonical entry of the type, NULL if it was put together by hand and
+	// hasn't been looked up
+	struct type_entry *entry;
 } type_t;
 
 typedef struct record_field {
@@ -100,50 +130,10 @@ typedef struct record {
 	buffer_t(record_field_t) fields;
 } record_t;
 
-char *type_as_string(type_t type) {
-	switch (type.kind) {
-		case TYPE_ARRAY:
-			return heap_fmt("(Array %s %d)", type_as_string(*type.child), type.count);
-		case TYPE_POINTER:
-			return heap_fmt("(@ %s)", type_as_string(*type.child));
-		case TYPE_RECORD:
-			return heap_fmt("(Record %s)", type.record);
-		default:
-			return type_str_lang[type.kind];
-	}
-}
-
-char *type_mangle(type_t type) {
-	switch (type.kind) {
-		case TYPE_ARRAY:
-			return heap_fmt("_Array%s_%d", type_mangle(*type.child), type.count);
-		case TYPE_POINTER:
-			return heap_fmt("_Pointer%s", type_mangle(*type.child));
-		case TYPE_RECORD:
-			return heap_fmt("_Record_%s", type.record);
-		default:
-			return heap_fmt("_%s", type_str_lang[type.kind]);
-	}
-}
-
-char *type_to_str(type_t type) {
-	switch (type.kind) {
-		case TYPE_ARRAY:
-			return type_mangle(type);
-		case TYPE_RECORD:
-			return heap_fmt("struct %s", type.record);
-		case TYPE_POINTER:
-			return heap_fmt("%s*", type_to_str(*type.child));
-		default:
-			return type_str[type.kind];
-
-	}
-}
-
-
 bool is_partial(type_t type) {
 	switch (type.kind) {
 		case TYPE_INTEGER:
+		case TYPE_FLOAT:
 			return true;
 
 		case TYPE_POINTER:
@@ -171,18 +161,382 @@ bool is_integer(type_t type) {
 	;
 }
 
+bool is_float(type_t type) {
+	return type.kind == TYPE_F32 or type.kind == TYPE_F64 or type.kind == TYPE_FLOAT;
+}
+
+bool is_numeric(type_t type) {
+	return is_integer(type) or is_float(type);
+}
+
 type_t type_kind(type_kind_t kind) {
-	type_t t;
+	type_t t = { 0 };
 	t.kind = kind;
 	return t;
 }
 
+// Whether two types are the same. Children are always canonical, so this
+// never has to look further than one level.
+bool type_same(type_t a, type_t b) {
+	if (a.kind != b.kind)
+		return false;
+
+	switch (a.kind) {
+		case TYPE_ARRAY:
+			return a.count == b.count and a.child == b.child;
+		case TYPE_POINTER:
+			return a.child == b.child;
+		case TYPE_RECORD:
+			return a.record == b.record;
+		case TYPE_VAR:
+			return a.count == b.count;
+		default:
+			return true;
+	}
+}
+
+uint64_t type_hash(type_t type) {
+	uint64_t key = (uint64_t)type.kind;
+
+	switch (type.kind) {
+		case TYPE_ARRAY:
+			key ^= (uint64_t)type.count << 8;
+			// fallthrough
+		case TYPE_POINTER:
+			key ^= (uint64_t)(uintptr_t)type.child << 16;
+			break;
+		case TYPE_RECORD:
+			key ^= (uint64_t)(uintptr_t)type.record << 16;
+			break;
+		case TYPE_VAR:
+			key ^= (uint64_t)type.count << 8;
+			break;
+		default:
+			break;
+	}
+
+	return map_int_hash(key);
+}
+
+typedef enum type_name_kind {
+	// Name in the generated C
+	TYPE_NAME_C,
+	// Name of the generated definition of an array type
+	TYPE_NAME_MANGLED,
+	// Name in error messages and logs
+	TYPE_NAME_DISPLAY,
+	TYPE_NAME_COUNT
+} type_name_kind_t;
+
+// The canonical copy of a type, along with its names once they're asked for
+typedef struct type_entry {
+	type_t type;
+	_Atomic(char *) names[TYPE_NAME_COUNT];
+} type_entry_t;
+
+// Open addressing hash table of canonical types, probed linearly, like the
+// string interner's. Entries are never removed, and a slot is only published
+// once the entry it points at is written, so types already in the table are
+// found without taking a lock.
+typedef struct type_slots {
+	size_t cap;
+	struct type_slots *retired;
+	_Atomic(type_entry_t *) slots[];
+} type_slots_t;
+
+// One shard of the type table. Inserting, growing and allocating entries
+// happen with the shard lock held.
+typedef struct type_shard {
+	_Atomic(type_slots_t *) table;
+	size_t len;
+	arena_t entries;
+	pthread_mutex_t lock;
+} type_shard_t;
+
+// Initial number of slots per shard, must be a power of 2
+#define TYPE_TABLE_MIN_CAP 64
+// Maximum percentage of slots in use before a table is grown
+#define TYPE_TABLE_MAX_LOAD 70
+// Number of shards (as a power of 2), chosen by the top bits of the hash
+#define TYPE_TABLE_SHARD_BITS 4
+#define TYPE_TABLE_SHARDS (1 << TYPE_TABLE_SHARD_BITS)
+
+// Every distinct type is hash-consed into one canonical copy, shared by all
+// threads. Child types always point at these, so equal types have equal
+// children and are compared and looked up without recursing.
+type_shard_t type_shards[TYPE_TABLE_SHARDS];
+pthread_once_t type_shards_once = PTHREAD_ONCE_INIT;
+
+void type_shards_init() {
+	for (size_t i = 0; i < TYPE_TABLE_SHARDS; i++)
+		if (pthread_mutex_init(&type_shards[i].lock, NULL) != 0)
+			error(1, "Failed to initialize type table lock");
+}
+
+type_shard_t *type_shard(uint64_t hash) {
+	return type_shards + (hash >> (64 - TYPE_TABLE_SHARD_BITS));
+}
+
+size_t type_slot(uint64_t hash, size_t cap) {
+	return (size_t)((hash * 11400714819323198485U) >> 32) & (cap - 1);
+}
+
+// Find the slot holding a type, or the empty slot it would be inserted into
+_Atomic(type_entry_t *) *type_probe(type_slots_t *table, uint64_t hash, type_t type) {
+	size_t i = type_slot(hash, table->cap);
+
+	for (;;) {
+		type_entry_t *entry = atomic_load_explicit(table->slots + i, memory_order_acquire);
+
+		if (entry == NULL or type_same(entry->type, type))
+			return table->slots + i;
+
+		i = (i + 1) & (table->cap - 1);
+	}
+}
+
+// Double the capacity of a shard's table. The old table is kept until
+// type_table_free, as readers may still be probing it.
+void type_grow(type_shard_t *shard) {
+	type_slots_t *old = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	size_t cap = old ? old->cap * 2 : TYPE_TABLE_MIN_CAP;
+	type_slots_t *table = calloc(1, offsetof(type_slots_t, slots) + cap * sizeof(type_entry_t *));
+
+	if (table == NULL)
+		error(1, "Failed to grow type table to %zu entries", cap);
+
+	table->cap = cap;
+	table->retired = old;
+
+	for (size_t i = 0; old != NULL and i < old->cap; i++) {
+		type_entry_t *entry = atomic_load_explicit(old->slots + i, memory_order_relaxed);
+
+		if (entry == NULL)
+			continue;
+
+		size_t j = type_slot(type_hash(entry->type), cap);
+		while (atomic_load_explicit(table->slots + j, memory_order_relaxed) != NULL)
+			j = (j + 1) & (cap - 1);
+
+		atomic_store_explicit(table->slots + j, entry, memory_order_relaxed);
+	}
+
+	atomic_store_explicit(&shard->table, table, memory_order_release);
+}
+
+// Look for the canonical entry of a type, without locking
+type_entry_t *type_find(uint64_t hash, type_t type) {
+	type_slots_t *table = atomic_load_explicit(&type_shard(hash)->table, memory_order_acquire);
+
+	if (table == NULL)
+		return NULL;
+
+	return atomic_load_explicit(type_probe(table, hash, type), memory_order_acquire);
+}
+
+// Canonical entry of a type, made by the first thread to ask for it
+type_entry_t *type_entry(type_t type) {
+	if (type.entry != NULL)
+		return type.entry;
+
+	uint64_t hash = type_hash(type);
+	type_entry_t *entry = type_find(hash, type);
+
+	if (entry != NULL)
+		return entry;
+
+	pthread_once(&type_shards_once, type_shards_init);
+
+	type_shard_t *shard = type_shard(hash);
+	pthread_mutex_lock(&shard->lock);
+
+	// Another thread may have added it since the lookup
+	entry = type_find(hash, type);
+
+	if (entry == NULL) {
+		type_slots_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+
+		if (table == NULL or (shard->len + 1) * 100 > table->cap * TYPE_TABLE_MAX_LOAD) {
+			type_grow(shard);
+			table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+		}
+
+		entry = arena_alloc(&shard->entries, sizeof(type_entry_t));
+		entry->type = type;
+		entry->type.entry = entry;
+
+		for (size_t i = 0; i < TYPE_NAME_COUNT; i++)
+			atomic_init(&entry->names[i], NULL);
+
+		// Publish only once the entry is written
+		atomic_store_explicit(type_probe(table, hash, type), entry, memory_order_release);
+		shard->len++;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+	return entry;
+}
+
+// Number of distinct types so far
+size_t type_table_count() {
+	size_t count = 0;
+
+	for (size_t i = 0; i < TYPE_TABLE_SHARDS; i++)
+		count += type_shards[i].len;
+
+	return count;
+}
+
+// Canonical copy of a type, whose child must already be canonical
+type_t *type_intern(type_t type) {
+	return &type_entry(type)->type;
+}
+
+// Compound types are always made canonical, so they carry their entry
 type_t type_ptr(type_t type) {
-	type_t t;
-	t.kind = TYPE_POINTER;
-	t.child = malloc(sizeof(type_t));
-	*t.child = type;
-	return t;
+	type_t t = type_kind(TYPE_POINTER);
+	t.child = type_intern(type);
+	return *type_intern(t);
+}
+
+type_t type_array(type_t type, size_t count) {
+	type_t t = type_kind(TYPE_ARRAY);
+
+	if (count > UINT32_MAX)
+		error(1, "Array length %zu is too large", count);
+
+	t.count = (uint32_t)count;
+	t.child = type_intern(type);
+	return *type_intern(t);
+}
+
+type_t type_record(char *name) {
+	type_t t = type_kind(TYPE_RECORD);
+	t.record = name;
+	return *type_intern(t);
+}
+
+// Keep the first name rendered for a type, in case another thread got there
+// first. The entry owns the name's buffer from then on.
+char *type_name_publish(type_entry_t *entry, type_name_kind_t kind, strbuf_t *sb) {
+	char *name = NULL;
+
+	if (atomic_compare_exchange_strong(&entry->names[kind], &name, sb->chars))
+		return sb->chars;
+
+	strbuf_free(sb);
+	return name;
+}
+
+// Names are rendered once per distinct type, later calls look them up
+char *type_as_string(type_t type) {
+	switch (type.kind) {
+		case TYPE_ARRAY:
+		case TYPE_POINTER:
+		case TYPE_RECORD:
+			break;
+		default:
+			return type_str_lang[type.kind];
+	}
+
+	type_entry_t *entry = type_entry(type);
+	char *name = atomic_load(&entry->names[TYPE_NAME_DISPLAY]);
+
+	if (name != NULL)
+		return name;
+
+	strbuf_t sb = { 0 };
+
+	if (type.kind == TYPE_ARRAY)
+		strbuf_fmt(&sb, "(Array %s %u)", type_as_string(*type.child), type.count);
+	else if (type.kind == TYPE_POINTER)
+		strbuf_fmt(&sb, "(@ %s)", type_as_string(*type.child));
+	else
+		strbuf_fmt(&sb, "(Record %s)", type.record);
+
+	return type_name_publish(entry, TYPE_NAME_DISPLAY, &sb);
+}
+
+char *type_mangle(type_t type) {
+	type_entry_t *entry = type_entry(type);
+	char *name = atomic_load(&entry->names[TYPE_NAME_MANGLED]);
+
+	if (name != NULL)
+		return name;
+
+	strbuf_t sb = { 0 };
+
+	switch (type.kind) {
+		case TYPE_ARRAY:
+			strbuf_fmt(&sb, "_Array%s_%u", type_mangle(*type.child), type.count);
+			break;
+		case TYPE_POINTER:
+			strbuf_fmt(&sb, "_Pointer%s", type_mangle(*type.child));
+			break;
+		case TYPE_RECORD:
+			strbuf_fmt(&sb, "_Record_%s", type.record);
+			break;
+		default:
+			strbuf_fmt(&sb, "_%s", type_str_lang[type.kind]);
+			break;
+	}
+
+	return type_name_publish(entry, TYPE_NAME_MANGLED, &sb);
+}
+
+char *type_to_str(type_t type) {
+	switch (type.kind) {
+		case TYPE_ARRAY:
+			return type_mangle(type);
+		case TYPE_RECORD:
+		case TYPE_POINTER:
+			break;
+		default:
+			return type_str[type.kind];
+	}
+
+	type_entry_t *entry = type_entry(type);
+	char *name = atomic_load(&entry->names[TYPE_NAME_C]);
+
+	if (name != NULL)
+		return name;
+
+	strbuf_t sb = { 0 };
+
+	if (type.kind == TYPE_RECORD)
+		strbuf_fmt(&sb, "struct %s", type.record);
+	else
+		strbuf_fmt(&sb, "%s*", type_to_str(*type.child));
+
+	return type_name_publish(entry, TYPE_NAME_C, &sb);
+}
+
+// Deallocate every canonical type. No other thread may be using the table.
+void type_table_free() {
+	for (size_t i = 0; i < TYPE_TABLE_SHARDS; i++) {
+		type_shard_t *shard = type_shards + i;
+		type_slots_t *table = atomic_load(&shard->table);
+
+		for (size_t j = 0; table != NULL and j < table->cap; j++) {
+			type_entry_t *entry = atomic_load(table->slots + j);
+
+			for (size_t k = 0; entry != NULL and k < TYPE_NAME_COUNT; k++) {
+				char *name = atomic_load(&entry->names[k]);
+				buffer_free(name);
+			}
+		}
+
+		arena_free(&shard->entries);
+
+		while (table != NULL) {
+			type_slots_t *retired = table->retired;
+			free(table);
+			table = retired;
+		}
+
+		atomic_store(&shard->table, NULL);
+		shard->len = 0;
+	}
 }
 
 bool is_string(type_t type) {
@@ -190,6 +544,9 @@ bool is_string(type_t type) {
 }
 
 bool type_cmp(type_t lhs, type_t rhs) {
+	if (type_same(lhs, rhs))
+		return true;
+
 	if (lhs.kind == TYPE_POINTER && rhs.kind == TYPE_POINTER)
 		return type_cmp(*lhs.child, *rhs.child);
 
@@ -199,73 +556,66 @@ bool type_cmp(type_t lhs, type_t rhs) {
 	else 
 		return 
 			   (is_integer(lhs) and is_integer(rhs)) 
+			or (is_float(lhs) and is_float(rhs))
 			or (is_string(lhs) and is_string(rhs))
 			or rhs.kind == lhs.kind
 		;
 }
 
-type_t parse_type(atom_t type) {
+// Kind of a builtin type from its name
+type_kind_t type_builtin(char *sym) {
+	switch (intern_id(sym)) {
+		case SYM_I8:   return TYPE_I8;
+		case SYM_U8:   return TYPE_U8;
+		case SYM_I16:  return TYPE_I16;
+		case SYM_U16:  return TYPE_U16;
+		case SYM_I32:  return TYPE_I32;
+		case SYM_U32:  return TYPE_U32;
+		case SYM_I64:  return TYPE_I64;
+		case SYM_U64:  return TYPE_U64;
+		case SYM_F32:  return TYPE_F32;
+		case SYM_F64:  return TYPE_F64;
+		case SYM_VOID: return TYPE_VOID;
+		case SYM_BOOL: return TYPE_BOOL;
+		default:
+			error(1, "Unknown type: %s", sym);
+			return TYPE_VOID;
+	}
+}
+
+// Arrays take a type and a length, pointers a type and records a name
+void ast_check_type_arity(atom_t type, size_t items) {
+	if (atom_len(type) != items + 1)
+		error(1, "Invalid argument count for type modifier");
+}
+
+type_t parse_type(atom_pool_t *pool, atom_t type) {
 	type_t t;
 
 	switch (type.kind) {
 		case ATOM_SYMBOL:
-			{}
-			char *sym = type.symbol_val;
-
-			if (strcmp(sym, "I8") == 0) {
-				t.kind = TYPE_I8;
-			}
-			 else if (strcmp(sym, "U8") == 0) {
-				t.kind = TYPE_U8;
-			}
-			else if (strcmp(sym, "I16") == 0) {
-				t.kind = TYPE_I16;
-			}
-			else if (strcmp(sym, "U16") == 0) {
-				t.kind = TYPE_U16;
-			}
-			else if (strcmp(sym, "I32") == 0) {
-				t.kind = TYPE_I32;
-			}
-			else if (strcmp(sym, "U32") == 0) {
-				t.kind = TYPE_U32;
-			}
-			else if (strcmp(sym, "I64") == 0) {
-				t.kind = TYPE_I64;
-			}
-			 else if (strcmp(sym, "U64") == 0) {
-				t.kind = TYPE_U64;
-			} else if (strcmp(sym, "Void") == 0) {
-				t.kind = TYPE_VOID;
-			} else if (strcmp(sym, "Bool") == 0) {
-				t.kind = TYPE_BOOL;
-			}
-			else 
-				error(1, "Unknown type: %s", sym);
-			
+			t = type_kind(type_builtin(type.symbol_val));
 			break;
 
 		case ATOM_EXPR:
-			if (is_symbol(type.expr[0], "Array")) {
-				t.kind = TYPE_ARRAY;
-				t.child = malloc(sizeof(type_t));
-				*t.child = parse_type(type.expr[1]);
+			if (is_keyword(atom_at(pool, type, 0), SYM_TYPE_ARRAY)) {
+				ast_check_type_arity(type, 2);
+				type_t child = parse_type(pool, atom_at(pool, type, 1));
 
-				if (type.expr[2].kind != ATOM_INTEGER) 
+				if (atom_at(pool, type, 2).kind != ATOM_INTEGER) 
 					error(1, "Array length must be integer");
 
-				t.count = (size_t)type.expr[2].integer_val;
-			} else if (is_symbol(type.expr[0], "@")) {
-				t.kind = TYPE_POINTER;
-				t.child = malloc(sizeof(type_t));
-				*t.child = parse_type(type.expr[1]);
-			} else if (is_symbol(type.expr[0], "Record")) {
-				t.kind = TYPE_RECORD;
+				t = type_array(child, (size_t)atom_at(pool, type, 2).integer_val);
+			} else if (is_keyword(atom_at(pool, type, 0), SYM_TYPE_POINTER)) {
+				ast_check_type_arity(type, 1);
+				t = type_ptr(parse_type(pool, atom_at(pool, type, 1)));
+			} else if (is_keyword(atom_at(pool, type, 0), SYM_TYPE_RECORD)) {
+				ast_check_type_arity(type, 1);
 
-				if (type.expr[1].kind != ATOM_SYMBOL)
+				if (atom_at(pool, type, 1).kind != ATOM_SYMBOL)
 					error(1, "Record name must be symbol");
 
-				t.record = type.expr[1].symbol_val;
+				t = type_record(atom_at(pool, type, 1).symbol_val);
 			} else 
 				error(1, "Invalid type modifier");
 			break;
@@ -280,6 +630,9 @@ type_t parse_type(atom_t type) {
 	return t;
 }
 
+// Expression nodes and lists of the AST, per thread like type_arena
+_Thread_local arena_t ast_arena = { 0 };
+
 typedef enum ast_binop_kind {
 	AST_BINOP_ADD = 1,
 	AST_BINOP_SUB,
@@ -298,6 +651,25 @@ typedef enum ast_binop_kind {
 	AST_BINOP_OR
 } ast_binop_kind_t;
 
+// Binary operator for each operator symbol
+ast_binop_kind_t sym_binop[] = {
+	[SYM_ADD]  = AST_BINOP_ADD,
+	[SYM_SUB]  = AST_BINOP_SUB,
+	[SYM_MUL]  = AST_BINOP_MUL,
+	[SYM_DIV]  = AST_BINOP_DIV,
+	[SYM_MOD]  = AST_BINOP_MOD,
+
+	[SYM_EQ]   = AST_BINOP_EQ,
+	[SYM_NEQ]  = AST_BINOP_NEQ,
+	[SYM_LT]   = AST_BINOP_LT,
+	[SYM_GT]   = AST_BINOP_GT,
+	[SYM_LTEQ] = AST_BINOP_LTEQ,
+	[SYM_GTEQ] = AST_BINOP_GTEQ,
+
+	[SYM_AND]  = AST_BINOP_AND,
+	[SYM_OR]   = AST_BINOP_OR
+};
+
 typedef enum ast_unop_kind {
 	AST_UNOP_NOT = 1
 } ast_unop_kind_t;
@@ -364,6 +736,7 @@ typedef struct ast_expr {
 		ast_aref_t aref;
 		ast_ref_t ref;
 		char *ref_to;
+		char *symbol_val;
 		int64_t int_val;
 		char *string_val;
 		buffer_t(char *) path;
@@ -373,19 +746,92 @@ typedef struct ast_expr {
 	};
 } ast_expr_t;
 
-buffer_t(char *) parse_path(char *symbol) {
-	buffer_t(char *) tmp;
+// AST construction keeps its pending work on an explicit stack rather than
+// recursing, so nesting depth is only limited by memory. Each item is an atom
+// and the slot its result goes to, which is allocated at its final place in
+// the arena before the item is queued.
+typedef struct ast_work {
+	enum {
+		AST_WORK_EXPR,
+		AST_WORK_BODY
+	} kind;
 
-	char *cur = symbol;
-	
-	for (size_t i = 0; i < strlen(symbol); i++) {
-		
+	atom_t atom;
+
+	union {
+		ast_expr_t *expr;
+		struct ast_statement **body;
+	};
+} ast_work_t;
+
+typedef small_buffer_t(ast_work_t, 32) ast_work_stack_t;
+
+// Queue the items of a list from first on, into consecutive slots. They
+// are pushed in reverse so they're built in source order.
+void ast_queue_exprs(ast_work_stack_t *work, atom_pool_t *pool, atom_t list, size_t first, ast_expr_t *dst) {
+	for (size_t i = atom_len(list); i > first; i--)
+		small_buffer_push(*work, (ast_work_t){ AST_WORK_EXPR, atom_at(pool, list, i - 1), { .expr = dst + (i - 1 - first) } });
+}
+
+void ast_queue_expr(ast_work_stack_t *work, atom_t atom, ast_expr_t *dst) {
+	small_buffer_push(*work, (ast_work_t){ AST_WORK_EXPR, atom, { .expr = dst } });
+}
+
+// Items a form takes after its head, one letter each: E for an expression,
+// N for a name, T for a type and B for a body. Forms with any number of
+// expressions, calls and arrays, have none. Both parse paths check against it.
+char *ast_form_shape(bool statement, char *head) {
+	if (statement) {
+		switch (intern_id(head)) {
+			case SYM_DECL:   return "NT";
+			case SYM_SET:    return "NE";
+			case SYM_LET:    return "NE";
+			case SYM_RETURN: return "E";
+			case SYM_IF:     return "EB";
+			case SYM_WHILE:  return "EB";
+			case SYM_STORE:  return "EE";
+			default:         return NULL;
+		}
 	}
 
-	return tmp;
+	switch (intern_id(head)) {
+		case SYM_ADD:
+		case SYM_SUB:
+		case SYM_MUL:
+		case SYM_DIV:
+		case SYM_MOD:
+		case SYM_AND:
+		case SYM_OR:
+		case SYM_EQ:
+		case SYM_LT:
+		case SYM_GT:
+		case SYM_LTEQ:
+		case SYM_GTEQ:
+		case SYM_NEQ:
+		case SYM_AREF:
+			return "EE";
+		case SYM_NOT:
+		case SYM_GET:
+			return "E";
+		case SYM_REF:
+			return "N";
+		case SYM_CAST:
+			return "ET";
+		default:
+			return NULL;
+	}
+}
+
+// Fail unless the form atom has as many items as its head takes
+void ast_check_arity(atom_t atom, bool statement, char *head) {
+	char *shape = ast_form_shape(statement, head);
+
+	if (shape and atom_len(atom) != strlen(shape) + 1)
+		error(1, "Invalid argument count for %s", head);
 }
 
-ast_expr_t parse_ast_expr(atom_t expr) {
+// Build one expression node into dst, queueing its operands
+void ast_build_expr(atom_pool_t *pool, atom_t expr, ast_expr_t *dst, ast_work_stack_t *work) {
 	ast_expr_t e;
 
 	switch (expr.kind) {
@@ -400,10 +846,10 @@ ast_expr_t parse_ast_expr(atom_t expr) {
 		case ATOM_SYMBOL:{}
 			char *sym = expr.symbol_val;
 
-			if (strcmp(sym, "true") == 0) {
+			if (intern_id(sym) == SYM_TRUE) {
 				e.kind = AST_EXPR_BOOL;
 				e.bool_val = true;
-			} else if (strcmp(sym, "false") == 0) {
+			} else if (intern_id(sym) == SYM_FALSE) {
 				e.kind = AST_EXPR_BOOL;
 				e.bool_val = false;
 			} else {
@@ -416,202 +862,100 @@ ast_expr_t parse_ast_expr(atom_t expr) {
 			e.float_val = expr.float_val;
 			break;
 		case ATOM_EXPR:
-			if (!is_symbol(expr.expr[0], NULL))
+			if (!is_symbol(atom_at(pool, expr, 0), NULL))
 				error(1, "Expression expected symbol");
 
-			char *op = expr.expr[0].symbol_val;
-
-			if (strcmp(op, "+") == 0) {
-        			e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_ADD;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "-") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_SUB;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "*") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_MUL;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "/") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_DIV;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "mod") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_MOD;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "and") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_AND;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "or") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_OR;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "=") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_EQ;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "<") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_LT;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, ">") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_GT;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "<=") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_LTEQ;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, ">=") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_GTEQ;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "!=") == 0) {
-				e.kind = AST_EXPR_BINOP;
-				e.binop.kind = AST_BINOP_NEQ;
-
-				e.binop.args[0] = malloc(sizeof(ast_expr_t));
-				e.binop.args[1] = malloc(sizeof(ast_expr_t));
-
-				*e.binop.args[0] = parse_ast_expr(expr.expr[1]);
-				*e.binop.args[1] = parse_ast_expr(expr.expr[2]);
-
-			} else if (strcmp(op, "not") == 0) {
-				e.kind = AST_EXPR_UNIOP;				
-				e.unop.kind = AST_UNOP_NOT;
-				e.unop.arg = malloc(sizeof(ast_unop_t));
-				*e.unop.arg = parse_ast_expr(expr.expr[1]);
-
-			}  else if (strcmp(op, "array") == 0) {
-				e.kind = AST_EXPR_ARRAY;
-				e.array = NULL;
-
-				for (size_t i = 1; i < buffer_len(expr.expr); i++)
-					buffer_push(e.array, parse_ast_expr(expr.expr[i]));
-
-			} else if (strcmp(op, "get") == 0) {
-				e.kind = AST_EXPR_GET;
-
-				e.get.ptr = malloc(sizeof(ast_expr_t));
-
-				*e.get.ptr = parse_ast_expr(expr.expr[1]);
-
-			}  else if (strcmp(op, "ref") == 0) {
-				e.kind = AST_EXPR_REF;
-
-				if (expr.expr[1].kind != ATOM_SYMBOL)
-					error(1, "ref expressions expects symbol");
-
-				e.ref.var = expr.expr[1].symbol_val;
-
-			} else if (strcmp(op, "aref") == 0) {
-				e.kind = AST_EXPR_AREF;
-
-				e.aref.array = malloc(sizeof(ast_expr_t));
-				e.aref.index = malloc(sizeof(ast_expr_t));
-
-				*e.aref.array = parse_ast_expr(expr.expr[1]);
-				*e.aref.index = parse_ast_expr(expr.expr[2]);
-				
-			} else if (strcmp(op, "cast") == 0 ) {
-				e.kind = AST_EXPR_CAST;
-
-				e.cast.from = malloc(sizeof(ast_expr_t));
-
-				*e.cast.from = parse_ast_expr(expr.expr[1]);
-				e.cast.to    = parse_type(expr.expr[2]);
-
-			} else {
-				e.kind = AST_EXPR_CALL;
-				e.call.name = op;
-				e.call.args = NULL;
-
-				for (size_t i = 1; i < buffer_len(expr.expr); i++) 
-					buffer_push(e.call.args, parse_ast_expr(expr.expr[i]));
+			char *op = atom_at(pool, expr, 0).symbol_val;
+			ast_check_arity(expr, false, op);
+
+			switch (intern_id(op)) {
+				case SYM_ADD:
+				case SYM_SUB:
+				case SYM_MUL:
+				case SYM_DIV:
+				case SYM_MOD:
+				case SYM_AND:
+				case SYM_OR:
+				case SYM_EQ:
+				case SYM_LT:
+				case SYM_GT:
+				case SYM_LTEQ:
+				case SYM_GTEQ:
+				case SYM_NEQ:
+					e.kind = AST_EXPR_BINOP;
+					e.binop.kind = sym_binop[intern_id(op)];
+
+					// Both operands share one allocation so they sit next to each other
+					e.binop.args[0] = arena_alloc(&ast_arena, 2*sizeof(ast_expr_t));
+					e.binop.args[1] = e.binop.args[0] + 1;
+
+					ast_queue_expr(work, atom_at(pool, expr, 2), e.binop.args[1]);
+					ast_queue_expr(work, atom_at(pool, expr, 1), e.binop.args[0]);
+					break;
+
+				case SYM_NOT:
+					e.kind = AST_EXPR_UNIOP;				
+					e.unop.kind = AST_UNOP_NOT;
+					e.unop.arg = arena_alloc(&ast_arena, sizeof(ast_expr_t));
+					ast_queue_expr(work, atom_at(pool, expr, 1), e.unop.arg);
+					break;
+
+				case SYM_ARRAY:
+					e.kind = AST_EXPR_ARRAY;
+					buffer_alloc_arena(&ast_arena, e.array, atom_len(expr) - 1);
+					ast_queue_exprs(work, pool, expr, 1, e.array);
+					break;
+
+				case SYM_GET:
+					e.kind = AST_EXPR_GET;
+
+					e.get.ptr = arena_alloc(&ast_arena, sizeof(ast_expr_t));
+
+					ast_queue_expr(work, atom_at(pool, expr, 1), e.get.ptr);
+					break;
+
+				case SYM_REF:
+					e.kind = AST_EXPR_REF;
+
+					if (atom_at(pool, expr, 1).kind != ATOM_SYMBOL)
+						error(1, "ref expressions expects symbol");
+
+					e.ref.var = atom_at(pool, expr, 1).symbol_val;
+					break;
+
+				case SYM_AREF:
+					e.kind = AST_EXPR_AREF;
+
+					e.aref.array = arena_alloc(&ast_arena, 2*sizeof(ast_expr_t));
+					e.aref.index = e.aref.array + 1;
+
+					ast_queue_expr(work, atom_at(pool, expr, 2), e.aref.index);
+					ast_queue_expr(work, atom_at(pool, expr, 1), e.aref.array);
+					break;
+
+				case SYM_CAST:
+					e.kind = AST_EXPR_CAST;
+
+					e.cast.from = arena_alloc(&ast_arena, sizeof(ast_expr_t));
+
+					ast_queue_expr(work, atom_at(pool, expr, 1), e.cast.from);
+					e.cast.to    = parse_type(pool, atom_at(pool, expr, 2));
+					break;
+
+				default:
+					e.kind = AST_EXPR_CALL;
+					e.call.name = op;
+					buffer_alloc_arena(&ast_arena, e.call.args, atom_len(expr) - 1);
+					ast_queue_exprs(work, pool, expr, 1, e.call.args);
+					break;
 			}
-
 			
 			break;
 	}
 
-	e.type = malloc(sizeof(type_t));
+	e.type = arena_alloc(&type_arena, sizeof(type_t));
 
-	return e;
+	*dst = e;
 }
 
 typedef enum ast_cflow_kind {
@@ -670,110 +1014,124 @@ typedef struct ast_statement {
 } ast_statement_t;
 
 
-buffer_t(ast_statement_t) parse_body(atom_t body) {
-	buffer_t(ast_statement_t) list = NULL;
-
+// Build the statements of a body, queueing their expressions and the bodies
+// of nested control flow
+buffer_t(ast_statement_t) ast_build_body(atom_pool_t *pool, atom_t body, ast_work_stack_t *work) {
 	if (body.kind != ATOM_EXPR)
 		error(1, "Function body must be an expression");
 
-	for (size_t i = 0; i < buffer_len(body.expr); i++) {
-		atom_t atom = body.expr[i];
+	buffer_t(ast_statement_t) stmts;
+	buffer_alloc_arena(&ast_arena, stmts, atom_len(body));
 
-		ast_statement_t st;
+	// Queued in reverse, like the items of a list
+	for (size_t i = atom_len(body); i-- > 0;) {
+		atom_t atom = atom_at(pool, body, i);
 
-		if (!is_symbol(atom.expr[0], NULL))
-			error(1, "Statement expects symbol as first item");
+		ast_statement_t *st = stmts + i;
 
-		char *symbol = atom.expr[0].symbol_val;
-
-		if (strcmp(symbol, "decl") == 0) {
-			if (buffer_len(atom.expr) != 3)
-				error(1, "Invalid argument count for decl");
-
-			st.kind = AST_STATEMENT_DECL;
-
-			if (!is_symbol(atom.expr[1], NULL))
-				error(1, "Variable identifier must be a symbol");
+		if (!is_symbol(atom_at(pool, atom, 0), NULL))
+			error(1, "Statement expects symbol as first item");
 
-			st.decl.name = atom.expr[1].symbol_val;
-			st.decl.type = parse_type(atom.expr[2]);
+		char *symbol = atom_at(pool, atom, 0).symbol_val;
+		ast_check_arity(atom, true, symbol);
 
-		} else if (strcmp(symbol, "set") == 0) {
-			if (buffer_len(atom.expr) != 3)
-				error(1, "Invalid argument count for set");
+		switch (intern_id(symbol)) {
+			case SYM_DECL:
+				st->kind = AST_STATEMENT_DECL;
 
-			st.kind = AST_STATEMENT_SET;
+				if (!is_symbol(atom_at(pool, atom, 1), NULL))
+					error(1, "Variable identifier must be a symbol");
 
-			if (!is_symbol(atom.expr[1], NULL))
-				error(1, "Variable identifier must be a symbol");
+				st->decl.name = atom_at(pool, atom, 1).symbol_val;
+				st->decl.type = parse_type(pool, atom_at(pool, atom, 2));
+				break;
 
-			st.set.name = atom.expr[1].symbol_val;
-			st.set.val  = parse_ast_expr(atom.expr[2]);
+			case SYM_SET:
+				st->kind = AST_STATEMENT_SET;
 
-		} else if (strcmp(symbol, "let") == 0) {
-			if (buffer_len(atom.expr) != 3)
-				error(1, "Invalid argument count for let");
+				if (!is_symbol(atom_at(pool, atom, 1), NULL))
+					error(1, "Variable identifier must be a symbol");
 
-			st.kind = AST_STATEMENT_LET;
+				st->set.name = atom_at(pool, atom, 1).symbol_val;
+				ast_queue_expr(work, atom_at(pool, atom, 2), &st->set.val);
+				break;
 
-			if (!is_symbol(atom.expr[1], NULL)) 
-				error(1, "Variable identifier must be a symbol");
+			case SYM_LET:
+				st->kind = AST_STATEMENT_LET;
 
-			st.let.name = atom.expr[1].symbol_val;
-			st.let.val  = parse_ast_expr(atom.expr[2]);
+				if (!is_symbol(atom_at(pool, atom, 1), NULL)) 
+					error(1, "Variable identifier must be a symbol");
 
-		} else if (strcmp(symbol, "return") == 0) {
-			if (buffer_len(atom.expr) != 2)
-				error(1, "Invalid argument count for set");
+				st->let.name = atom_at(pool, atom, 1).symbol_val;
+				ast_queue_expr(work, atom_at(pool, atom, 2), &st->let.val);
+				break;
 
-			st.kind = AST_STATEMENT_RETURN;
+			case SYM_RETURN:
+				st->kind = AST_STATEMENT_RETURN;
 
-			st.ret = parse_ast_expr(atom.expr[1]);
+				ast_queue_expr(work, atom_at(pool, atom, 1), &st->ret);
+				break;
 
-		} else if (strcmp(symbol, "if") == 0) {
-			if (buffer_len(atom.expr) != 3)
-				error(1, "Invalid argument count for if");
+			case SYM_IF:
+			case SYM_WHILE:
+				st->kind = AST_STATEMENT_CFLOW;
+				st->cflow.kind = intern_id(symbol) == SYM_IF ? AST_CFLOW_IF : AST_CFLOW_WHILE;
 
-			st.kind = AST_STATEMENT_CFLOW;
+				small_buffer_push(*work, (ast_work_t){ AST_WORK_BODY, atom_at(pool, atom, 2), { .body = &st->cflow.body } });
+				ast_queue_expr(work, atom_at(pool, atom, 1), &st->cflow.cond);
+				break;
 
-			st.cflow.kind = AST_CFLOW_IF;
-			st.cflow.cond = parse_ast_expr(atom.expr[1]);
-			st.cflow.body = parse_body(atom.expr[2]);
+			case SYM_STORE:
+				st->kind = AST_STATEMENT_STORE;
 
-		} else if (strcmp(symbol, "while") == 0) {
-			if (buffer_len(atom.expr) != 3)
-				error(1, "Invalid argument count for while");
+				ast_queue_expr(work, atom_at(pool, atom, 2), &st->store.val);
+				ast_queue_expr(work, atom_at(pool, atom, 1), &st->store.ptr);
+				break;
 
-			st.kind = AST_STATEMENT_CFLOW;
+			default:
+				st->kind = AST_STATEMENT_CALL;
 
-			st.cflow.kind = AST_CFLOW_WHILE;
-			st.cflow.cond = parse_ast_expr(atom.expr[1]);
-			st.cflow.body = parse_body(atom.expr[2]);
+				st->call.name = symbol;
+				buffer_alloc_arena(&ast_arena, st->call.args, atom_len(atom) - 1);
+				ast_queue_exprs(work, pool, atom, 1, st->call.args);
+				break;
+		}
+	}
 
-		} else if (strcmp(symbol, "store") == 0) {
-			if (buffer_len(atom.expr) != 3)
-				error(1, "Invalid argument count for store");
+	return stmts;
+}
 
-			st.kind = AST_STATEMENT_STORE;
+// Run queued work until there is none left
+void ast_build(atom_pool_t *pool, ast_work_stack_t *work) {
+	while (small_buffer_len(*work) != 0) {
+		ast_work_t item = small_buffer_pop(*work);
 
-			st.store.ptr = parse_ast_expr(atom.expr[1]);
-			st.store.val = parse_ast_expr(atom.expr[2]);
+		if (item.kind == AST_WORK_EXPR)
+			ast_build_expr(pool, item.atom, item.expr, work);
+		else
+			*item.body = ast_build_body(pool, item.atom, work);
+	}
+}
 
-		} else {
-			st.kind = AST_STATEMENT_CALL;
+ast_expr_t parse_ast_expr(atom_pool_t *pool, atom_t expr) {
+	ast_work_stack_t work = { 0 };
+	ast_expr_t e;
 
-			st.call.name = symbol;
-			st.call.args = NULL;
+	ast_queue_expr(&work, expr, &e);
+	ast_build(pool, &work);
+	small_buffer_free(work);
 
-			for (size_t i = 1; i < buffer_len(atom.expr); i++) 
-				buffer_push(st.call.args, parse_ast_expr(atom.expr[i]));
-		}
+	return e;
+}
 
+buffer_t(ast_statement_t) parse_body(atom_pool_t *pool, atom_t body) {
+	ast_work_stack_t work = { 0 };
+	buffer_t(ast_statement_t) stmts = ast_build_body(pool, body, &work);
 
-		buffer_push(list, st);
-	}
+	ast_build(pool, &work);
+	small_buffer_free(work);
 
-	return list;
+	return stmts;
 }
 
 typedef struct ast_arg {
@@ -794,21 +1152,23 @@ void ast_print_args(buffer_t(ast_arg_t) args, int tabs) {
 	printf("\n");
 }
 
-buffer_t(ast_arg_t) parse_args(atom_t args, bool *vararg) {
-	buffer_t(ast_arg_t) list = NULL;
+buffer_t(ast_arg_t) parse_args(atom_pool_t *pool, atom_t args, bool *vararg) {
+	small_buffer_t(ast_arg_t, 4) list = { 0 };
 
 	*vararg = false;
 
 	if (args.kind != ATOM_EXPR)
 		error(1, "Argument list must be an expression");
 	
-	for (size_t i = 0; i < buffer_len(args.expr); i++) {
-		if (is_symbol(args.expr[i], "...")) {
+	for (size_t i = 0; i < atom_len(args); i++) {
+		atom_t arg_atom = atom_at(pool, args, i);
+
+		if (is_keyword(arg_atom, SYM_VARARG)) {
 			*vararg = true;
 			break;
-		} else if (args.expr[i].kind == ATOM_EXPR) {
-			atom_t name = args.expr[i].expr[0];
-			atom_t type = args.expr[i].expr[1];
+		} else if (arg_atom.kind == ATOM_EXPR) {
+			atom_t name = atom_at(pool, arg_atom, 0);
+			atom_t type = atom_at(pool, arg_atom, 1);
 
 			if (!is_symbol(name, NULL))
 				error(1, "Argument name must be a symbol");
@@ -816,14 +1176,17 @@ buffer_t(ast_arg_t) parse_args(atom_t args, bool *vararg) {
 			ast_arg_t arg;
 
 			arg.name = name.symbol_val;
-			arg.type = parse_type(type);
+			arg.type = parse_type(pool, type);
 
-			buffer_push(list, arg);
+			small_buffer_push(list, arg);
 		} else 
 			error(1, "Function argument must be (Name Type) or ...");
 	}
 
-	return list;
+	buffer_t(ast_arg_t) args_list = small_buffer_to_arena(&ast_arena, list);
+	small_buffer_free(list);
+
+	return args_list;
 }
 
 typedef struct ast_func {
@@ -854,7 +1217,7 @@ typedef struct ast_program {
 	buffer_t(ast_tl_t) items;
 } ast_program_t;
 
-ast_program_t parse_program(atom_t program) {
+ast_program_t parse_program(atom_pool_t *pool, atom_t program) {
 	log_info("Begin AST generation");
 	
 	ast_program_t prog;
@@ -862,89 +1225,98 @@ ast_program_t parse_program(atom_t program) {
 
 	assert(program.kind == ATOM_EXPR);
 
-	for (size_t i = 0; i < buffer_len(program.expr); i++) {
-		if (program.expr[i].kind != ATOM_EXPR)
+	for (size_t i = 0; i < atom_len(program); i++) {
+		if (atom_at(pool, program, i).kind != ATOM_EXPR)
 			error(1, "Expected expression, found atom");
 		
-		if (!is_symbol(program.expr[i].expr[0], NULL)) 
+		if (!is_symbol(atom_at(pool, atom_at(pool, program, i), 0), NULL)) 
 			error(1, "Top level of program expects declarations");
 
-		atom_t expr = program.expr[i];
-		char *symbol = expr.expr[0].symbol_val;
+		atom_t expr = atom_at(pool, program, i);
+		char *symbol = atom_at(pool, expr, 0).symbol_val;
 
 		ast_tl_t item;
 		item.kind = AST_TL_FUNC;
 
-		if (strcmp(symbol, "include") == 0) {
-			item.kind = AST_TL_INCLUDE;
+		switch (intern_id(symbol)) {
+			case SYM_INCLUDE:
+				item.kind = AST_TL_INCLUDE;
 
-			if (buffer_len(expr.expr) != 2)
-				error(1, "Invalid arguments to include");
+				if (atom_len(expr) != 2)
+					error(1, "Invalid arguments to include");
 
-			if (expr.expr[1].kind != ATOM_STRING) 
-				error(1, "Include expects string");
+				if (atom_at(pool, expr, 1).kind != ATOM_STRING) 
+					error(1, "Include expects string");
 
-			item.inc_file = expr.expr[1].string_val;
+				item.inc_file = atom_at(pool, expr, 1).string_val;
+				break;
 
-		} else if (strcmp(symbol, "func") == 0) {
-			item.kind = AST_TL_FUNC;
+			case SYM_FUNC:
+				item.kind = AST_TL_FUNC;
 
-			ast_func_t func;
+				ast_func_t func;
 
-			if (!is_symbol(expr.expr[1], NULL)) 
-				error(1, "Function identifier must be a symbol");
+				if (!is_symbol(atom_at(pool, expr, 1), NULL)) 
+					error(1, "Function identifier must be a symbol");
 
-			func.name = intern_str(expr.expr[1].symbol_val);
-			func.args = parse_args(expr.expr[2], &func.vararg);
-			func.ret = parse_type(expr.expr[3]);
-                        func.body = NULL;
+				func.name = intern_str(atom_at(pool, expr, 1).symbol_val);
+				func.args = parse_args(pool, atom_at(pool, expr, 2), &func.vararg);
+				func.ret = parse_type(pool, atom_at(pool, expr, 3));
+				func.body = NULL;
 
-			if (buffer_len(expr.expr) == 4) {
-				item.func = func;
-				goto LOOP_END;
-			} else if (buffer_len(expr.expr) == 5) {
-				func.body = parse_body(expr.expr[4]);
-				item.func = func;
-			} else 
-				error(1, "Invalid argument count to func");
+				if (atom_len(expr) == 4) {
+					item.func = func;
+					goto LOOP_END;
+				} else if (atom_len(expr) == 5) {
+					func.body = parse_body(pool, atom_at(pool, expr, 4));
+					item.func = func;
+				} else 
+					error(1, "Invalid argument count to func");
+				break;
 
-		} else if (strcmp(symbol, "record") == 0) {
-			item.kind = AST_TL_RECORD;
+			case SYM_RECORD:
+				item.kind = AST_TL_RECORD;
 
-			record_t record;
+				record_t record;
 
-			if (!is_symbol(expr.expr[1], NULL))
-				error(1, "Record name must be a symbol");
+				if (!is_symbol(atom_at(pool, expr, 1), NULL))
+					error(1, "Record name must be a symbol");
 
-			record.name = expr.expr[1].symbol_val;
-			record.fields = NULL;
+				record.name = atom_at(pool, expr, 1).symbol_val;
+				small_buffer_t(record_field_t, 8) fields = { 0 };
 
-			if (expr.expr[2].kind != ATOM_EXPR)
-				error(1, "Record expects list of fields");
+				if (atom_at(pool, expr, 2).kind != ATOM_EXPR)
+					error(1, "Record expects list of fields");
 
-			for (size_t i = 0; i < buffer_len(expr.expr[2].expr); i++) {
-				atom_t field_atom = expr.expr[2].expr[i];
+				for (size_t i = 0; i < atom_len(atom_at(pool, expr, 2)); i++) {
+					atom_t field_atom = atom_at(pool, atom_at(pool, expr, 2), i);
 
-				record_field_t field;
+					record_field_t field;
 
-				if (field_atom.kind != ATOM_EXPR and buffer_len(field_atom.expr) != 2)
-					error(1, "Record field must be in format (name type)");
+					if (field_atom.kind != ATOM_EXPR and atom_len(field_atom) != 2)
+						error(1, "Record field must be in format (name type)");
 
-				if (field_atom.expr[0].kind != ATOM_SYMBOL)
-					error(1, "Record field must have symbol identifier");
+					if (atom_at(pool, field_atom, 0).kind != ATOM_SYMBOL)
+						error(1, "Record field must have symbol identifier");
 
-				field.name = field_atom.expr[0].symbol_val;
-				field.type = parse_type(field_atom.expr[1]);
+					field.name = atom_at(pool, field_atom, 0).symbol_val;
+					field.type = parse_type(pool, atom_at(pool, field_atom, 1));
 
-				buffer_push(record.fields, field);
-			}	
+					small_buffer_push(fields, field);
+				}	
 
-			item.record = record;
-		} else {
-			error(1, "Unknown top level item");
+				record.fields = small_buffer_to_arena(&ast_arena, fields);
+				small_buffer_free(fields);
+
+				item.record = record;
+				break;
+
+			default:
+				error(1, "Unknown top level item");
+				break;
 		}
 		LOOP_END:
-		buffer_push(prog.items, item);
+		buffer_push_arena(&ast_arena, prog.items, item);
 		//ast_print_tl(item);
 	}
 
@@ -952,3 +1324,441 @@ ast_program_t parse_program(atom_t program) {
 
 	return prog;
 }
+
+// Structural equality of ASTs, for tests comparing ways of building them.
+// Symbols and strings are interned, so they compare by pointer.
+bool ast_type_eq(type_t a, type_t b) {
+	if (a.kind != b.kind)
+		return false;
+
+	switch (a.kind) {
+		case TYPE_ARRAY:
+			return a.count == b.count and ast_type_eq(*a.child, *b.child);
+		case TYPE_POINTER:
+			return ast_type_eq(*a.child, *b.child);
+		case TYPE_RECORD:
+			return a.record == b.record;
+		default:
+			return true;
+	}
+}
+
+bool ast_expr_eq(ast_expr_t a, ast_expr_t b);
+
+bool ast_exprs_eq(buffer_t(ast_expr_t) a, buffer_t(ast_expr_t) b) {
+	if (buffer_len(a) != buffer_len(b))
+		return false;
+
+	for (size_t i = 0; i < buffer_len(a); i++)
+		if (!ast_expr_eq(a[i], b[i]))
+			return false;
+
+	return true;
+}
+
+bool ast_expr_eq(ast_expr_t a, ast_expr_t b) {
+	if (a.kind != b.kind)
+		return false;
+
+	switch (a.kind) {
+		case AST_EXPR_BINOP:
+			return a.binop.kind == b.binop.kind
+				and ast_expr_eq(*a.binop.args[0], *b.binop.args[0])
+				and ast_expr_eq(*a.binop.args[1], *b.binop.args[1]);
+		case AST_EXPR_UNIOP:
+			return a.unop.kind == b.unop.kind and ast_expr_eq(*a.unop.arg, *b.unop.arg);
+		case AST_EXPR_SYMBOL:
+			return a.symbol_val == b.symbol_val;
+		case AST_EXPR_STRING:
+			return a.string_val == b.string_val;
+		case AST_EXPR_INTEGER:
+			return a.int_val == b.int_val;
+		case AST_EXPR_FLOAT:
+			return a.float_val == b.float_val;
+		case AST_EXPR_BOOL:
+			return a.bool_val == b.bool_val;
+		case AST_EXPR_ARRAY:
+			return ast_exprs_eq(a.array, b.array);
+		case AST_EXPR_GET:
+			return ast_expr_eq(*a.get.ptr, *b.get.ptr);
+		case AST_EXPR_AREF:
+			return ast_expr_eq(*a.aref.array, *b.aref.array) and ast_expr_eq(*a.aref.index, *b.aref.index);
+		case AST_EXPR_CALL:
+			return a.call.name == b.call.name and ast_exprs_eq(a.call.args, b.call.args);
+		case AST_EXPR_REF:
+			return a.ref.var == b.ref.var;
+		case AST_EXPR_CAST:
+			return ast_type_eq(a.cast.to, b.cast.to) and ast_expr_eq(*a.cast.from, *b.cast.from);
+	}
+
+	return false;
+}
+
+bool ast_body_eq(buffer_t(ast_statement_t) a, buffer_t(ast_statement_t) b) {
+	if (buffer_len(a) != buffer_len(b))
+		return false;
+
+	for (size_t i = 0; i < buffer_len(a); i++) {
+		ast_statement_t x = a[i];
+		ast_statement_t y = b[i];
+		bool eq = x.kind == y.kind;
+
+		switch (x.kind) {
+			case AST_STATEMENT_DECL:
+				eq = eq and x.decl.name == y.decl.name and ast_type_eq(x.decl.type, y.decl.type);
+				break;
+			case AST_STATEMENT_SET:
+				eq = eq and x.set.name == y.set.name and ast_expr_eq(x.set.val, y.set.val);
+				break;
+			case AST_STATEMENT_LET:
+				eq = eq and x.let.name == y.let.name and ast_expr_eq(x.let.val, y.let.val);
+				break;
+			case AST_STATEMENT_CFLOW:
+				eq = eq and x.cflow.kind == y.cflow.kind
+					and ast_expr_eq(x.cflow.cond, y.cflow.cond)
+					and ast_body_eq(x.cflow.body, y.cflow.body);
+				break;
+			case AST_STATEMENT_RETURN:
+				eq = eq and ast_expr_eq(x.ret, y.ret);
+				break;
+			case AST_STATEMENT_STORE:
+				eq = eq and ast_expr_eq(x.store.ptr, y.store.ptr) and ast_expr_eq(x.store.val, y.store.val);
+				break;
+			case AST_STATEMENT_CALL:
+				eq = eq and x.call.name == y.call.name and ast_exprs_eq(x.call.args, y.call.args);
+				break;
+		}
+
+		if (!eq)
+			return false;
+	}
+
+	return true;
+}
+
+bool ast_tl_eq(ast_tl_t a, ast_tl_t b) {
+	if (a.kind != b.kind)
+		return false;
+
+	switch (a.kind) {
+		case AST_TL_INCLUDE:
+			return a.inc_file == b.inc_file;
+
+		case AST_TL_FUNC:
+			if (
+				a.func.name != b.func.name
+				or a.func.vararg != b.func.vararg
+				or buffer_len(a.func.args) != buffer_len(b.func.args)
+				or !ast_type_eq(a.func.ret, b.func.ret)
+			)
+				return false;
+
+			for (size_t i = 0; i < buffer_len(a.func.args); i++)
+				if (a.func.args[i].name != b.func.args[i].name or !ast_type_eq(a.func.args[i].type, b.func.args[i].type))
+					return false;
+
+			return ast_body_eq(a.func.body, b.func.body);
+
+		case AST_TL_RECORD:
+			if (a.record.name != b.record.name or buffer_len(a.record.fields) != buffer_len(b.record.fields))
+				return false;
+
+			for (size_t i = 0; i < buffer_len(a.record.fields); i++)
+				if (a.record.fields[i].name != b.record.fields[i].name or !ast_type_eq(a.record.fields[i].type, b.record.fields[i].type))
+					return false;
+
+			return true;
+	}
+
+	return false;
+}
+
+// A function whose body nests depth ifs, the innermost returning depth
+// nested additions, NUL terminated
+char *ast_nesting_source(size_t depth, size_t *len) {
+	buffer_t(char) source = NULL;
+	char *parts[] = {
+		"(func main [] I64 {\n",
+		"(if true {", "(return ", "(+ 1 ", "0", ")", ")", "})", "})\n"
+	};
+	size_t counts[] = { 1, depth, 1, depth, 1, depth, 1, depth, 1 };
+
+	for (size_t i = 0; i < sizeof(parts)/sizeof(*parts); i++)
+		for (size_t j = 0; j < counts[i]; j++)
+			for (char *c = parts[i]; *c != 0; c++)
+				buffer_push(source, *c);
+
+	*len = buffer_len(source);
+	buffer_push(source, 0);
+	return source;
+}
+
+// Lex, parse and build the AST of a source into a fresh pool
+ast_program_t ast_parse_source(char *source, size_t len) {
+	lexer_t lexer;
+	atom_pool_t pool = { 0 };
+
+	lexer_init_buffer(&lexer, source, len);
+	token_stream_t tokens = lexer_tokenize(&lexer);
+	ast_program_t prog = parse_program(&pool, parse(&pool, &tokens));
+
+	token_stream_free(&tokens);
+	atom_pool_free(&pool);
+	return prog;
+}
+
+// Check a program parsed from ast_nesting_source has every level in place
+test_result_t ast_nesting_check(ast_program_t prog, size_t depth) {
+	if (buffer_len(prog.items) != 1)
+		return test_fail("Parsed %zu items, expected 1", buffer_len(prog.items));
+
+	buffer_t(ast_statement_t) body = prog.items[0].func.body;
+	size_t ifs = 0;
+
+	for (; buffer_len(body) == 1 and body[0].kind == AST_STATEMENT_CFLOW; body = body[0].cflow.body)
+		ifs++;
+
+	if (ifs != depth or buffer_len(body) != 1 or body[0].kind != AST_STATEMENT_RETURN)
+		return test_fail("Found %zu nested ifs, expected %zu around a return", ifs, depth);
+
+	ast_expr_t expr = body[0].ret;
+	size_t adds = 0;
+
+	for (; expr.kind == AST_EXPR_BINOP; expr = *expr.binop.args[1]) {
+		if (expr.binop.args[0]->kind != AST_EXPR_INTEGER or expr.binop.args[0]->int_val != 1)
+			return test_fail("Wrong left operand at depth %zu", adds);
+		adds++;
+	}
+
+	if (adds != depth or expr.kind != AST_EXPR_INTEGER or expr.int_val != 0)
+		return test_fail("Found %zu nested additions, expected %zu", adds, depth);
+
+	return test_pass();
+}
+
+test_result_t ast_nesting_test() {
+	// Deep enough to overflow the stack of a recursive parser
+	size_t depth = 200000;
+	size_t len;
+	char *source = ast_nesting_source(depth, &len);
+	test_result_t result = ast_nesting_check(ast_parse_source(source, len), depth);
+
+	buffer_free(source);
+	return result;
+}
+
+// A body of more statements than the work stack holds inline, whose items
+// are popped and pushed again after it spills
+test_result_t ast_wide_test() {
+	size_t count = 100;
+	buffer_t(char) source = NULL;
+	char line[64];
+
+	for (char *c = "(func main [ (a I64) ] I64 {\n"; *c != 0; c++)
+		buffer_push(source, *c);
+
+	for (size_t i = 0; i <= count; i++) {
+		if (i < count)
+			snprintf(line, sizeof(line), "(let x%zu (+ a %zu))\n", i, i);
+		else
+			snprintf(line, sizeof(line), "(return a) })\n");
+
+		for (char *c = line; *c != 0; c++)
+			buffer_push(source, *c);
+	}
+
+	ast_program_t prog = ast_parse_source(source, buffer_len(source));
+	buffer_free(source);
+
+	if (buffer_len(prog.items) != 1)
+		return test_fail("Parsed %zu items, expected 1", buffer_len(prog.items));
+
+	buffer_t(ast_statement_t) body = prog.items[0].func.body;
+
+	if (buffer_len(body) != count + 1)
+		return test_fail("Body has %zu statements, expected %zu", buffer_len(body), count + 1);
+
+	for (size_t i = 0; i < count; i++) {
+		ast_expr_t val = body[i].let.val;
+
+		if (body[i].kind != AST_STATEMENT_LET or val.kind != AST_EXPR_BINOP or val.binop.args[1]->int_val != (int64_t)i)
+			return test_fail("Statement %zu is wrong", i);
+	}
+
+	if (body[count].kind != AST_STATEMENT_RETURN)
+		return test_fail("Last statement isn't the return");
+
+	return test_pass();
+}
+
+// Equal types must share their canonical copy, different ones must not
+test_result_t type_intern_test() {
+	char *source = "(func f [ (a (@ (Array (@ U8) 4))) (b (@ (Array (@ U8) 4))) (c (@ (Array (@ U8) 5))) ] Void)";
+	ast_program_t prog = ast_parse_source(source, strlen(source));
+	buffer_t(ast_arg_t) args = prog.items[0].func.args;
+
+	if (args[0].type.child != args[1].type.child or !type_same(args[0].type, args[1].type))
+		return test_fail("Equal parsed types have different children");
+
+	if (args[0].type.child == args[2].type.child or type_same(args[0].type, args[2].type))
+		return test_fail("Arrays of different lengths share a child");
+
+	if (args[0].type.child->child != args[2].type.child->child)
+		return test_fail("Equal element types have different children");
+
+	type_t built = type_ptr(type_array(type_ptr(type_kind(TYPE_U8)), 4));
+
+	if (built.child != args[0].type.child)
+		return test_fail("Built type differs from the parsed one");
+
+	type_t a = type_kind(TYPE_RECORD);
+	type_t b = type_kind(TYPE_RECORD);
+	a.record = intern_str("A");
+	b.record = intern_str("B");
+
+	if (type_intern(a) == type_intern(b))
+		return test_fail("Records with different names share a type");
+
+	if (type_intern(type_kind(TYPE_I64)) != type_intern(type_kind(TYPE_I64)))
+		return test_fail("Builtin type interned twice");
+
+	return test_pass();
+}
+
+// Shared between the threads of type_table_mt_test and type_table_bench
+typedef struct type_worker {
+	type_t **results;
+	size_t count;
+	size_t offset;
+	size_t rounds;
+} type_worker_t;
+
+// Intern arrays of every length below count, starting at a different
+// length on each thread
+void *type_worker(void *arg) {
+	type_worker_t *worker = arg;
+
+	for (size_t r = 0; r < worker->rounds; r++) {
+		for (size_t i = 0; i < worker->count; i++) {
+			size_t j = (i + worker->offset) % worker->count;
+			worker->results[j] = type_intern(type_array(type_ptr(type_kind(TYPE_U32)), j));
+		}
+	}
+
+	return NULL;
+}
+
+// Run threads interning the same types, each one's results are stored in results[t * count...]
+void type_run_workers(type_t **results, size_t count, size_t threads, size_t rounds) {
+	pthread_t ids[threads];
+	type_worker_t workers[threads];
+
+	for (size_t t = 0; t < threads; t++) {
+		workers[t] = (type_worker_t){ results + t * count, count, t * count / threads, rounds };
+
+		if (pthread_create(ids + t, NULL, type_worker, workers + t) != 0)
+			error(1, "Failed to start type table thread");
+	}
+
+	for (size_t t = 0; t < threads; t++)
+		pthread_join(ids[t], NULL);
+}
+
+// Intern the same types from several threads at once, every thread must see
+// the same canonical copies
+test_result_t type_table_mt_test() {
+	size_t count = 20000;
+	size_t threads = 8;
+	type_t **results = malloc(count * threads * sizeof(type_t *));
+
+	type_run_workers(results, count, threads, 1);
+
+	for (size_t i = 0; i < count; i++) {
+		if (results[i]->kind != TYPE_ARRAY or results[i]->count != i)
+			return test_fail("Type %zu came back as %s", i, type_as_string(*results[i]));
+
+		for (size_t t = 1; t < threads; t++)
+			if (results[t * count + i] != results[i])
+				return test_fail("Threads 0 and %zu got different copies of type %zu", t, i);
+	}
+
+	free(results);
+	return test_pass();
+}
+
+// Lookups of types already in the table, by number of threads
+void type_table_bench() {
+	size_t count = 200000;
+	type_t **results = malloc(count * 16 * sizeof(type_t *));
+
+	uint64_t start = bench_now();
+	type_run_workers(results, count, 1, 1);
+	uint64_t cold = bench_now() - start;
+
+	printf("types  1 thread:  cold %7.2f Mops/s\n", (double)count * 1e3 / (double)cold);
+
+	for (size_t threads = 1; threads <= 16; threads *= 2) {
+		start = bench_now();
+		type_run_workers(results, count, threads, 4);
+		uint64_t warm = bench_now() - start;
+
+		printf(
+			"types %2zu threads: warm %7.2f Mops/s\n",
+			threads, (double)(count * threads * 4) * 1e3 / (double)warm
+		);
+	}
+
+	free(results);
+}
+
+// Names come out right and are only rendered once per type
+test_result_t type_names_test() {
+	type_t rec = type_kind(TYPE_RECORD);
+	rec.record = intern_str("Pair");
+	type_t type = type_ptr(type_array(type_ptr(rec), 3));
+
+	char *expect[][2] = {
+		{ type_as_string(type), "(@ (Array (@ (Record Pair)) 3))" },
+		{ type_mangle(type), "_Pointer_Array_Pointer_Record_Pair_3" },
+		{ type_to_str(type), "_Array_Pointer_Record_Pair_3*" },
+		{ type_to_str(*type.child->child), "struct Pair*" },
+	};
+
+	for (size_t i = 0; i < sizeof(expect)/sizeof(*expect); i++)
+		if (strcmp(expect[i][0], expect[i][1]) != 0)
+			return test_fail("Expected '%s', found '%s'", expect[i][1], expect[i][0]);
+
+	type_t again = type_ptr(type_array(type_ptr(rec), 3));
+
+	if (type_as_string(again) != expect[0][0] or type_mangle(again) != expect[1][0] or type_to_str(again) != expect[2][0])
+		return test_fail("Names of an equal type were rendered again");
+
+	// Built types carry their entry, so their names are found without a lookup
+	if (again.entry == NULL or again.entry != type.entry or type.entry->type.entry != type.entry)
+		return test_fail("Built type doesn't carry its canonical entry");
+
+	return test_pass();
+}
+
+// Parsing throughput of deeply nested sources, from text to AST
+void ast_nesting_bench() {
+	// Other benchmarks may have reset the interner, keywords must come first
+	intern_free();
+	symbols_init();
+
+	for (size_t depth = 1000; depth <= 1000000; depth *= 10) {
+		size_t len;
+		char *source = ast_nesting_source(depth, &len);
+
+		uint64_t start = bench_now();
+		ast_parse_source(source, len);
+		uint64_t elapsed = bench_now() - start;
+
+		printf(
+			"depth %7zu: %8.2f ms, %8.1f MB/s\n",
+			depth, (double)elapsed / 1e6, (double)len / 1e6 / ((double)elapsed / 1e9)
+		);
+
+		buffer_free(source);
+	}
+}
@@ -0,0 +1,828 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#pragma once
+
+// Parsing straight from tokens to the AST, without building atoms first.
+// Every form is recognised from its head symbol as soon as it's read, so
+// each token is looked at once and no atom pool is ever allocated. The atom
+// path in parser.h and ast.h stays for when macros need the atoms.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iso646.h>
+
+#include <utils/buffer.h>
+#include <utils/arena.h>
+#include <utils/intern.h>
+#include <utils/bench.h>
+#include <utils/test.h>
+#include <utils/misc.h>
+#include <utils/log.h>
+
+#include <frontend/symbols.h>
+#include <frontend/lexer.h>
+#include <frontend/parser.h>
+#include <frontend/ast.h>
+
+// Lists that nest without limit, bodies, statements and expressions, are
+// each an open frame on an explicit stack. Their finished children wait on
+// the parser's value stacks until the frame's ')' builds the node.
+typedef enum direct_frame_kind {
+	DIRECT_BODY,
+	DIRECT_STMT,
+	DIRECT_EXPR
+} direct_frame_kind_t;
+
+typedef struct direct_frame {
+	direct_frame_kind_t kind;
+	token_t open;
+
+	// Items read so far, the head symbol included
+	uint32_t items;
+	char *head;
+	char *shape;
+
+	// Where the frame's children start on the value stacks
+	size_t exprs;
+	size_t stmts;
+
+	// Items of the form that aren't expressions
+	char *name;
+	type_t type;
+	buffer_t(ast_statement_t) body;
+} direct_frame_t;
+
+typedef struct direct_parser {
+	token_stream_t *tokens;
+
+	buffer_t(direct_frame_t) frames;
+	buffer_t(ast_expr_t) exprs;
+	buffer_t(ast_statement_t) stmts;
+
+	// Last body closed with no statement around it
+	buffer_t(ast_statement_t) body;
+} direct_parser_t;
+
+// Exit with an error at a token
+void direct_fail(direct_parser_t *p, token_t at, char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	char *msg = vheap_fmt(fmt, args);
+	va_end(args);
+
+	source_loc_t loc = token_location(p->tokens, at);
+	error(1, "%zu:%zu: %s", loc.line, loc.column, msg);
+}
+
+// Next token inside the list opened at open
+token_t direct_next(direct_parser_t *p, token_t open) {
+	token_t next = token_stream_next(p->tokens);
+
+	if (next.kind == TOKEN_EOF)
+		direct_fail(p, open, "Expected ')' to close this expression, found EOF");
+
+	return next;
+}
+
+void direct_close(direct_parser_t *p, token_t open, char *what) {
+	token_t next = direct_next(p, open);
+
+	if (next.kind != TOKEN_RPAREN)
+		direct_fail(p, next, "Expected ')' to close %s", what);
+}
+
+char *direct_symbol(direct_parser_t *p, token_t token) {
+	char *text = token_text(p->tokens->source, token);
+	return intern_range(text, text + token_len(token));
+}
+
+// Interned contents of a string literal, without the quotation marks
+char *direct_string(direct_parser_t *p, token_t token) {
+	char *text = token_text(p->tokens->source, token);
+	return intern_range(text + 1, text + token_len(token) - 1);
+}
+
+uint32_t direct_keyword(direct_parser_t *p, token_t token) {
+	return token.kind == TOKEN_SYMBOL ? intern_id(direct_symbol(p, token)) : SYM_COUNT;
+}
+
+ast_expr_t direct_atom(direct_parser_t *p, token_t token) {
+	ast_expr_t e;
+
+	switch (token.kind) {
+		case TOKEN_INT:
+			e.kind = AST_EXPR_INTEGER;
+			e.int_val = token.int_val;
+			break;
+		case TOKEN_FLOAT:
+			e.kind = AST_EXPR_FLOAT;
+			e.float_val = token.float_val;
+			break;
+		case TOKEN_STRING:
+			e.kind = AST_EXPR_STRING;
+			e.string_val = direct_string(p, token);
+			break;
+		case TOKEN_SYMBOL:{}
+			char *sym = direct_symbol(p, token);
+
+			if (intern_id(sym) == SYM_TRUE or intern_id(sym) == SYM_FALSE) {
+				e.kind = AST_EXPR_BOOL;
+				e.bool_val = intern_id(sym) == SYM_TRUE;
+			} else {
+				e.kind = AST_EXPR_SYMBOL;
+				e.symbol_val = sym;
+			}
+			break;
+		default:
+			direct_fail(p, token, "Unhandled token kind: %d", token.kind);
+	}
+
+	e.type = arena_alloc(&type_arena, sizeof(type_t));
+	return e;
+}
+
+typedef struct direct_modifier {
+	type_kind_t kind;
+	token_t open;
+} direct_modifier_t;
+
+// Parse a type starting at first. Pointer and array modifiers are collected
+// on the way in and wrapped around the innermost type on the way out, where
+// an array's length and the closing parens follow.
+type_t direct_type(direct_parser_t *p, token_t first) {
+	small_buffer_t(direct_modifier_t, 4) mods = { 0 };
+	token_t token = first;
+	type_t t;
+
+	for (;;) {
+		if (token.kind == TOKEN_SYMBOL) {
+			t = type_kind(type_builtin(direct_symbol(p, token)));
+			break;
+		}
+
+		if (token.kind != TOKEN_LPAREN)
+			direct_fail(p, token, "Type must be an expression or symbol");
+
+		token_t head = direct_next(p, token);
+
+		switch (direct_keyword(p, head)) {
+			case SYM_TYPE_POINTER:
+			case SYM_TYPE_ARRAY:
+				small_buffer_push(mods, ((direct_modifier_t){
+					direct_keyword(p, head) == SYM_TYPE_ARRAY ? TYPE_ARRAY : TYPE_POINTER, token
+				}));
+				token = direct_next(p, token);
+				continue;
+
+			case SYM_TYPE_RECORD:{}
+				token_t name = direct_next(p, token);
+
+				if (name.kind != TOKEN_SYMBOL)
+					direct_fail(p, name, "Record name must be symbol");
+
+				t = type_record(direct_symbol(p, name));
+				direct_close(p, token, "the type");
+				break;
+
+			default:
+				direct_fail(p, head, "Invalid type modifier");
+		}
+
+		break;
+	}
+
+	while (small_buffer_len(mods) != 0) {
+		direct_modifier_t mod = small_buffer_pop(mods);
+
+		if (mod.kind == TYPE_ARRAY) {
+			token_t count = direct_next(p, mod.open);
+
+			if (count.kind != TOKEN_INT)
+				direct_fail(p, count, "Array length must be an integer");
+
+			t = type_array(t, (size_t)count.int_val);
+		} else {
+			t = type_ptr(t);
+		}
+
+		direct_close(p, mod.open, "the type");
+	}
+
+	small_buffer_free(mods);
+	return t;
+}
+
+void direct_push(direct_parser_t *p, direct_frame_kind_t kind, token_t open) {
+	direct_frame_t frame = { 0 };
+	frame.kind = kind;
+	frame.open = open;
+	frame.exprs = buffer_len(p->exprs);
+	frame.stmts = buffer_len(p->stmts);
+	buffer_push(p->frames, frame);
+}
+
+// Take the next item of the innermost frame
+void direct_item(direct_parser_t *p, token_t token) {
+	direct_frame_t *f = p->frames + buffer_len(p->frames) - 1;
+	uint32_t i = f->items++;
+
+	if (f->kind == DIRECT_BODY) {
+		if (token.kind != TOKEN_LPAREN)
+			direct_fail(p, token, "Statement must be an expression");
+
+		direct_push(p, DIRECT_STMT, token);
+		return;
+	}
+
+	if (i == 0) {
+		if (token.kind != TOKEN_SYMBOL)
+			direct_fail(p, token, f->kind == DIRECT_STMT ? "Statement expects symbol as first item" : "Expression expected symbol");
+
+		f->head = direct_symbol(p, token);
+		f->shape = ast_form_shape(f->kind == DIRECT_STMT, f->head);
+		return;
+	}
+
+	char slot = 'E';
+
+	if (f->shape) {
+		if (i > strlen(f->shape))
+			direct_fail(p, f->open, "Invalid argument count for %s", f->head);
+
+		slot = f->shape[i - 1];
+	}
+
+	switch (slot) {
+		case 'E':
+			if (token.kind == TOKEN_LPAREN)
+				direct_push(p, DIRECT_EXPR, token);
+			else
+				buffer_push(p->exprs, direct_atom(p, token));
+			break;
+
+		case 'N':
+			if (token.kind != TOKEN_SYMBOL)
+				direct_fail(p, token, f->kind == DIRECT_STMT ? "Variable identifier must be a symbol" : "ref expressions expects symbol");
+
+			f->name = direct_symbol(p, token);
+			break;
+
+		case 'T':
+			f->type = direct_type(p, token);
+			break;
+
+		case 'B':
+			if (token.kind != TOKEN_LPAREN)
+				direct_fail(p, token, "Function body must be an expression");
+
+			direct_push(p, DIRECT_BODY, token);
+			break;
+	}
+}
+
+// Copy the expressions pushed since base into the arena
+buffer_t(ast_expr_t) direct_take_exprs(direct_parser_t *p, size_t base) {
+	return buffer__copy_arena(&ast_arena, p->exprs + base, buffer_len(p->exprs) - base, sizeof(ast_expr_t));
+}
+
+ast_statement_t direct_statement(direct_parser_t *p, direct_frame_t *f) {
+	ast_expr_t *args = p->exprs + f->exprs;
+	ast_statement_t st;
+
+	switch (intern_id(f->head)) {
+		case SYM_DECL:
+			st.kind = AST_STATEMENT_DECL;
+			st.decl.name = f->name;
+			st.decl.type = f->type;
+			break;
+		case SYM_SET:
+			st.kind = AST_STATEMENT_SET;
+			st.set.name = f->name;
+			st.set.val = args[0];
+			break;
+		case SYM_LET:
+			st.kind = AST_STATEMENT_LET;
+			st.let.name = f->name;
+			st.let.val = args[0];
+			break;
+		case SYM_RETURN:
+			st.kind = AST_STATEMENT_RETURN;
+			st.ret = args[0];
+			break;
+		case SYM_IF:
+		case SYM_WHILE:
+			st.kind = AST_STATEMENT_CFLOW;
+			st.cflow.kind = intern_id(f->head) == SYM_IF ? AST_CFLOW_IF : AST_CFLOW_WHILE;
+			st.cflow.cond = args[0];
+			st.cflow.body = f->body;
+			break;
+		case SYM_STORE:
+			st.kind = AST_STATEMENT_STORE;
+			st.store.ptr = args[0];
+			st.store.val = args[1];
+			break;
+		default:
+			st.kind = AST_STATEMENT_CALL;
+			st.call.name = f->head;
+			st.call.args = direct_take_exprs(p, f->exprs);
+			break;
+	}
+
+	if (p->exprs)
+		buffer__hdr(p->exprs)->len = f->exprs;
+
+	return st;
+}
+
+ast_expr_t direct_expr(direct_parser_t *p, direct_frame_t *f) {
+	ast_expr_t *args = p->exprs + f->exprs;
+	ast_expr_t e;
+
+	switch (intern_id(f->head)) {
+		case SYM_ADD:
+		case SYM_SUB:
+		case SYM_MUL:
+		case SYM_DIV:
+		case SYM_MOD:
+		case SYM_AND:
+		case SYM_OR:
+		case SYM_EQ:
+		case SYM_LT:
+		case SYM_GT:
+		case SYM_LTEQ:
+		case SYM_GTEQ:
+		case SYM_NEQ:
+			e.kind = AST_EXPR_BINOP;
+			e.binop.kind = sym_binop[intern_id(f->head)];
+
+			// Both operands share one allocation so they sit next to each other
+			e.binop.args[0] = arena_alloc(&ast_arena, 2*sizeof(ast_expr_t));
+			e.binop.args[1] = e.binop.args[0] + 1;
+			*e.binop.args[0] = args[0];
+			*e.binop.args[1] = args[1];
+			break;
+
+		case SYM_NOT:
+			e.kind = AST_EXPR_UNIOP;
+			e.unop.kind = AST_UNOP_NOT;
+			e.unop.arg = arena_alloc(&ast_arena, sizeof(ast_expr_t));
+			*e.unop.arg = args[0];
+			break;
+
+		case SYM_ARRAY:
+			e.kind = AST_EXPR_ARRAY;
+			e.array = direct_take_exprs(p, f->exprs);
+			break;
+
+		case SYM_GET:
+			e.kind = AST_EXPR_GET;
+			e.get.ptr = arena_alloc(&ast_arena, sizeof(ast_expr_t));
+			*e.get.ptr = args[0];
+			break;
+
+		case SYM_REF:
+			e.kind = AST_EXPR_REF;
+			e.ref.var = f->name;
+			break;
+
+		case SYM_AREF:
+			e.kind = AST_EXPR_AREF;
+			e.aref.array = arena_alloc(&ast_arena, 2*sizeof(ast_expr_t));
+			e.aref.index = e.aref.array + 1;
+			*e.aref.array = args[0];
+			*e.aref.index = args[1];
+			break;
+
+		case SYM_CAST:
+			e.kind = AST_EXPR_CAST;
+			e.cast.from = arena_alloc(&ast_arena, sizeof(ast_expr_t));
+			*e.cast.from = args[0];
+			e.cast.to = f->type;
+			break;
+
+		default:
+			e.kind = AST_EXPR_CALL;
+			e.call.name = f->head;
+			e.call.args = direct_take_exprs(p, f->exprs);
+			break;
+	}
+
+	if (p->exprs)
+		buffer__hdr(p->exprs)->len = f->exprs;
+
+	e.type = arena_alloc(&type_arena, sizeof(type_t));
+	return e;
+}
+
+// Close the innermost frame, handing what it built to the one around it
+void direct_reduce(direct_parser_t *p) {
+	direct_frame_t f = p->frames[--buffer__hdr(p->frames)->len];
+
+	if (f.kind == DIRECT_BODY) {
+		size_t count = buffer_len(p->stmts) - f.stmts;
+		buffer_t(ast_statement_t) body = buffer__copy_arena(&ast_arena, p->stmts + f.stmts, count, sizeof(ast_statement_t));
+
+		if (p->stmts)
+			buffer__hdr(p->stmts)->len = f.stmts;
+
+		// Bodies only nest as the last item of if and while
+		if (buffer_len(p->frames) != 0)
+			p->frames[buffer_len(p->frames) - 1].body = body;
+		else
+			p->body = body;
+
+		return;
+	}
+
+	if (f.items == 0)
+		direct_fail(p, f.open, f.kind == DIRECT_STMT ? "Statement expects symbol as first item" : "Expression expected symbol");
+
+	if (f.shape and f.items != strlen(f.shape) + 1)
+		direct_fail(p, f.open, "Invalid argument count for %s", f.head);
+
+	// Built before pushing, as building pops the children
+	if (f.kind == DIRECT_STMT) {
+		ast_statement_t st = direct_statement(p, &f);
+		buffer_push(p->stmts, st);
+	} else {
+		ast_expr_t e = direct_expr(p, &f);
+		buffer_push(p->exprs, e);
+	}
+}
+
+// Parse a body, open is its opening paren
+buffer_t(ast_statement_t) direct_body(direct_parser_t *p, token_t open) {
+	direct_push(p, DIRECT_BODY, open);
+
+	while (buffer_len(p->frames) != 0) {
+		token_t next = token_stream_next(p->tokens);
+
+		if (next.kind == TOKEN_EOF)
+			direct_fail(p, p->frames[buffer_len(p->frames) - 1].open, "Expected ')' to close this expression, found EOF");
+		else if (next.kind == TOKEN_RPAREN)
+			direct_reduce(p);
+		else
+			direct_item(p, next);
+	}
+
+	return p->body;
+}
+
+buffer_t(ast_arg_t) direct_args(direct_parser_t *p, token_t open, bool *vararg) {
+	small_buffer_t(ast_arg_t, 4) list = { 0 };
+
+	*vararg = false;
+
+	if (open.kind != TOKEN_LPAREN)
+		direct_fail(p, open, "Argument list must be an expression");
+
+	for (;;) {
+		token_t next = direct_next(p, open);
+
+		if (next.kind == TOKEN_RPAREN)
+			break;
+
+		if (*vararg)
+			direct_fail(p, next, "... must be the last argument");
+
+		if (direct_keyword(p, next) == SYM_VARARG) {
+			*vararg = true;
+			continue;
+		}
+
+		if (next.kind != TOKEN_LPAREN)
+			direct_fail(p, next, "Function argument must be (Name Type) or ...");
+
+		token_t name = direct_next(p, next);
+
+		if (name.kind != TOKEN_SYMBOL)
+			direct_fail(p, name, "Argument name must be a symbol");
+
+		ast_arg_t arg;
+		arg.name = direct_symbol(p, name);
+		arg.type = direct_type(p, direct_next(p, next));
+
+		direct_close(p, next, "the argument");
+		small_buffer_push(list, arg);
+	}
+
+	buffer_t(ast_arg_t) args = small_buffer_to_arena(&ast_arena, list);
+	small_buffer_free(list);
+
+	return args;
+}
+
+ast_func_t direct_func(direct_parser_t *p, token_t open) {
+	ast_func_t func;
+	token_t name = direct_next(p, open);
+
+	if (name.kind != TOKEN_SYMBOL)
+		direct_fail(p, name, "Function identifier must be a symbol");
+
+	func.name = direct_symbol(p, name);
+	func.args = direct_args(p, direct_next(p, open), &func.vararg);
+	func.ret = direct_type(p, direct_next(p, open));
+	func.body = NULL;
+
+	token_t next = direct_next(p, open);
+
+	if (next.kind == TOKEN_LPAREN) {
+		func.body = direct_body(p, next);
+		next = direct_next(p, open);
+	}
+
+	if (next.kind != TOKEN_RPAREN)
+		direct_fail(p, next, "Invalid argument count to func");
+
+	return func;
+}
+
+record_t direct_record(direct_parser_t *p, token_t open) {
+	record_t record;
+	token_t name = direct_next(p, open);
+
+	if (name.kind != TOKEN_SYMBOL)
+		direct_fail(p, name, "Record name must be a symbol");
+
+	record.name = direct_symbol(p, name);
+
+	token_t list = direct_next(p, open);
+
+	if (list.kind != TOKEN_LPAREN)
+		direct_fail(p, list, "Record expects list of fields");
+
+	small_buffer_t(record_field_t, 8) fields = { 0 };
+
+	for (;;) {
+		token_t next = direct_next(p, list);
+
+		if (next.kind == TOKEN_RPAREN)
+			break;
+
+		if (next.kind != TOKEN_LPAREN)
+			direct_fail(p, next, "Record field must be in format (name type)");
+
+		token_t field_name = direct_next(p, next);
+
+		if (field_name.kind != TOKEN_SYMBOL)
+			direct_fail(p, field_name, "Record field must have symbol identifier");
+
+		record_field_t field;
+		field.name = direct_symbol(p, field_name);
+		field.type = direct_type(p, direct_next(p, next));
+
+		direct_close(p, next, "the field");
+		small_buffer_push(fields, field);
+	}
+
+	record.fields = small_buffer_to_arena(&ast_arena, fields);
+	small_buffer_free(fields);
+
+	direct_close(p, open, "the record");
+	return record;
+}
+
+// Parse a whole token stream into a program
+ast_program_t parse_direct(token_stream_t *tokens) {
+	log_info("Begin direct parsing");
+
+	direct_parser_t p = { 0 };
+	p.tokens = tokens;
+
+	ast_program_t prog;
+	prog.items = NULL;
+
+	for (;;) {
+		token_t open = token_stream_next(tokens);
+
+		if (open.kind == TOKEN_EOF)
+			break;
+
+		if (open.kind != TOKEN_LPAREN)
+			direct_fail(&p, open, "Expected expression, found atom");
+
+		token_t head = direct_next(&p, open);
+
+		if (head.kind != TOKEN_SYMBOL)
+			direct_fail(&p, head, "Top level of program expects declarations");
+
+		ast_tl_t item;
+
+		switch (direct_keyword(&p, head)) {
+			case SYM_INCLUDE:
+				item.kind = AST_TL_INCLUDE;
+
+				token_t file = direct_next(&p, open);
+
+				if (file.kind != TOKEN_STRING)
+					direct_fail(&p, file, "Include expects string");
+
+				item.inc_file = direct_string(&p, file);
+				direct_close(&p, open, "the include");
+				break;
+
+			case SYM_FUNC:
+				item.kind = AST_TL_FUNC;
+				item.func = direct_func(&p, open);
+				break;
+
+			case SYM_RECORD:
+				item.kind = AST_TL_RECORD;
+				item.record = direct_record(&p, open);
+				break;
+
+			default:
+				direct_fail(&p, head, "Unknown top level item");
+		}
+
+		buffer_push_arena(&ast_arena, prog.items, item);
+	}
+
+	buffer_free(p.frames);
+	buffer_free(p.exprs);
+	buffer_free(p.stmts);
+
+	log_info("End direct parsing");
+	return prog;
+}
+
+// Every form the language has, for comparing both ways of parsing
+char *direct_test_source =
+	"(include \"stdio.h\")\n"
+	"(record Pair { (a I32) (b (@ (Array (Record Pair) 4))) })\n"
+	"(func printf [ (fmt (@ U8)) ... ] I32)\n"
+	"(func empty [] Void {})\n"
+	"(func f [ (x I64) (y (Array (@ F64) 3)) ] Bool {\n"
+	"\t(decl p (Record Pair))\n"
+	"\t(decl arr (Array (Array I64 2) 3))\n"
+	"\t(let a (array 1 2.5 \"s\" true false x))\n"
+	"\t(set x (+ (- 1 2) (* (/ 3 4) (% 5 6))))\n"
+	"\t(while (and (< x 1) (or (> x 2) (not (= x 3)))) {\n"
+	"\t\t(if (<= (>= x 1) (!= x 2)) { (return false) })\n"
+	"\t\t(store (ref x) (get (aref arr 1)))\n"
+	"\t})\n"
+	"\t(printf \"%f\" (cast x F64) (g) (h (g) 1e3))\n"
+	"\t(g)\n"
+	"\t(return true)\n"
+	"})\n";
+
+ast_program_t direct_parse_source(char *source, size_t len) {
+	lexer_t lexer;
+
+	lexer_init_buffer(&lexer, source, len);
+	token_stream_t tokens = lexer_tokenize(&lexer);
+	ast_program_t prog = parse_direct(&tokens);
+
+	token_stream_free(&tokens);
+	lexer_close(&lexer);
+	return prog;
+}
+
+// Forms with extra items, both paths must reject them
+char *direct_rejected_source[] = {
+	"(func f [] I64 { (return (+ 1 2 3)) })",
+	"(func f [] I64 { (return (cast 1 I64 2)) })",
+	"(func f [] Void { (decl x (@ I64 3)) })",
+	"(func f [] Void { (decl x (Array I64 2 3)) })",
+	"(func f [] Void { (let x (not true false)) })",
+	"(func f [] Void { (return 1 2) })",
+};
+
+// Whether parsing source fails, directly or through atoms
+bool direct_rejects(char *source, bool direct) {
+	jmp_buf *outer = error_trap;
+	jmp_buf trap;
+	bool failed = false;
+
+	if (setjmp(trap) == 0) {
+		error_trap = &trap;
+
+		if (direct)
+			direct_parse_source(source, strlen(source));
+		else
+			ast_parse_source(source, strlen(source));
+	} else {
+		failed = true;
+	}
+
+	error_trap = outer;
+	return failed;
+}
+
+// The direct parser must build the same AST as going through atoms
+test_result_t parse_direct_test() {
+	size_t len = strlen(direct_test_source);
+	ast_program_t expect = ast_parse_source(direct_test_source, len);
+	ast_program_t prog = direct_parse_source(direct_test_source, len);
+
+	if (buffer_len(prog.items) != buffer_len(expect.items))
+		return test_fail("Parsed %zu items, expected %zu", buffer_len(prog.items), buffer_len(expect.items));
+
+	for (size_t i = 0; i < buffer_len(prog.items); i++)
+		if (!ast_tl_eq(prog.items[i], expect.items[i]))
+			return test_fail("Item %zu differs from the atom path", i);
+
+	for (size_t i = 0; i < sizeof(direct_rejected_source)/sizeof(*direct_rejected_source); i++) {
+		if (!direct_rejects(direct_rejected_source[i], false))
+			return test_fail("Atom path accepted %s", direct_rejected_source[i]);
+
+		if (!direct_rejects(direct_rejected_source[i], true))
+			return test_fail("Direct path accepted %s", direct_rejected_source[i]);
+	}
+
+	size_t depth = 200000;
+	char *source = ast_nesting_source(depth, &len);
+	test_result_t result = ast_nesting_check(direct_parse_source(source, len), depth);
+
+	buffer_free(source);
+	return result;
+}
+
+// Bytes held by the arenas the AST lives in
+size_t direct_arena_bytes() {
+	return ast_arena.reserved + type_arena.reserved;
+}
+
+// Time and peak working memory of both ways from tokens to AST. The token
+// stream is shared, so memory is what each builds on top of it: the atom
+// pool for the atom path, the frame and value stacks for the direct one,
+// and the AST arenas for both.
+void parse_direct_bench() {
+	// Other benchmarks may have reset the interner, keywords must come first
+	intern_free();
+	symbols_init();
+
+	size_t len;
+	char *buf = lexer_bench_source(&len);
+
+	lexer_t lexer;
+	lexer_init_buffer(&lexer, buf, len);
+	token_stream_t tokens = lexer_tokenize(&lexer);
+
+	size_t reps = 5;
+	uint64_t atom_time = 0;
+	uint64_t direct_time = 0;
+	size_t atom_bytes = 0;
+	size_t direct_bytes = 0;
+
+	for (size_t i = 0; i < reps; i++) {
+		tokens.pos = 0;
+		uint64_t start = bench_now();
+
+		atom_pool_t pool = { 0 };
+		parse_program(&pool, parse(&pool, &tokens));
+		atom_time += bench_now() - start;
+
+		atom_bytes = direct_arena_bytes()
+			+ buffer_cap(pool.atoms)*sizeof(atom_t)
+			+ buffer_cap(pool.stack)*sizeof(atom_t)
+			+ buffer_cap(pool.frames)*sizeof(parse_frame_t);
+
+		atom_pool_free(&pool);
+		arena_free(&ast_arena);
+		arena_free(&type_arena);
+
+		tokens.pos = 0;
+		start = bench_now();
+
+		parse_direct(&tokens);
+		direct_time += bench_now() - start;
+
+		// Its stacks only ever hold one top-level form, a few KB at most
+		direct_bytes = direct_arena_bytes();
+
+		arena_free(&ast_arena);
+		arena_free(&type_arena);
+	}
+
+	printf(
+		"atoms:  %8.1f MB/s, %7.1f MB working memory\n"
+		"direct: %8.1f MB/s, %7.1f MB working memory\n",
+		(double)len / 1e6 / ((double)atom_time / (double)reps / 1e9), (double)atom_bytes / 1e6,
+		(double)len / 1e6 / ((double)direct_time / (double)reps / 1e9), (double)direct_bytes / 1e6
+	);
+
+	token_stream_free(&tokens);
+	lexer_close(&lexer);
+	free(buf);
+}
@@ -34,30 +34,180 @@
 #include <utils/misc.h>
 #include <utils/intern.h>
 #include <utils/utf8.h>
+#include <utils/number.h>
+#include <utils/bench.h>
+#include <utils/test.h>
 
-char *lexer_stream = NULL;
-size_t lexer_index = 0;
+#include <frontend/scan.h>
 
-wint_t peek = WEOF;
+// Offsets at which the lines of an input start. Only built the first time a
+// location is asked for, so lexing never pays for it.
+typedef struct line_index {
+	buffer_t(size_t) starts;
+	bool built;
+} line_index_t;
+
+// A position in the source, both starting at 1 and columns counted in codepoints
+typedef struct source_loc {
+	size_t line;
+	size_t column;
+} source_loc_t;
+
+void line_index_build(line_index_t *lines, const char *s, size_t len) {
+	scan_init();
+
+	buffer_push(lines->starts, 0);
+	for (size_t pos = 0; (pos = scan.newline(s, pos, len)) < len; pos++)
+		buffer_push(lines->starts, pos + 1);
+
+	lines->built = true;
+}
+
+// Location of a byte offset in the len bytes of s
+source_loc_t line_index_locate(line_index_t *lines, const char *s, size_t len, size_t offset) {
+	if (!lines->built)
+		line_index_build(lines, s, len);
+
+	// Find the last line starting at or before offset
+	size_t lo = 0;
+	size_t hi = buffer_len(lines->starts);
+
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo)/2;
+
+		if (lines->starts[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	source_loc_t loc = { lo + 1, 1 };
+
+	for (size_t i = lines->starts[lo]; i < offset and i < len; i++)
+		if (((uint8_t)s[i] & 0xc0) != 0x80)
+			loc.column++;
+
+	return loc;
+}
+
+// Location just past the len bytes of s, given the location s starts at
+source_loc_t source_loc_advance(source_loc_t loc, const char *s, size_t len) {
+	scan_init();
+
+	size_t line_start = 0;
+
+	for (size_t pos = 0; (pos = scan.newline(s, pos, len)) < len; pos++) {
+		loc.line++;
+		loc.column = 1;
+		line_start = pos + 1;
+	}
+
+	for (size_t i = line_start; i < len; i++)
+		if (((uint8_t)s[i] & 0xc0) != 0x80)
+			loc.column++;
+
+	return loc;
+}
+
+// Exit with the location of the first malformed sequence of s[0..len),
+// given the location s starts at, if it isn't valid UTF-8
+void source_check_utf8(const char *s, size_t len, source_loc_t origin) {
+	scan_init();
+
+	if (scan.utf8(s, len))
+		return;
+
+	source_loc_t loc = source_loc_advance(origin, s, utf8_validate(s, len));
+	error(1, "%zu:%zu: Invalid UTF-8 in input", loc.line, loc.column);
+}
+
+void line_index_free(line_index_t *lines) {
+	buffer_free(lines->starts);
+	lines->built = false;
+}
+
+// Lexing state of a single input, lexers share nothing so any number of them
+// can run at once on different threads
+typedef struct lexer {
+	char *stream;
+	size_t length;
+	size_t index;
+
+	wint_t peek;
+	// Offset of peek in the stream
+	size_t peek_index;
+
+	line_index_t lines;
+	// Location of the first byte of the stream, for inputs read in parts
+	source_loc_t origin;
+
+	// How the stream was obtained, and so how lexer_close releases it
+	enum {
+		LEXER_BORROWED,
+		LEXER_MAPPED
+	} owner;
+} lexer_t;
 
 // Read a single Unicode codepoint 
-wint_t lexer_read() {
-	if (lexer_stream[lexer_index] == 0) {
-		peek = WEOF;
-		return WEOF;
+wint_t lexer_read(lexer_t *lexer) {
+	lexer->peek_index = lexer->index;
+
+	uint8_t byte = lexer->index < lexer->length ? (uint8_t)lexer->stream[lexer->index] : 0;
+
+	if (byte == 0) {
+		wint_t p = lexer->peek;
+		lexer->peek = WEOF;
+		return p;
+	} else if (byte < 0x80) {
+		lexer->index++;
+		wint_t p = lexer->peek;
+		lexer->peek = byte;
+		return p;
 	} else {
-		uint8_t char_size = utf8_char_size(lexer_stream + lexer_index);
-		wint_t c = utf8_to_int(lexer_stream + lexer_index);
-		lexer_index += char_size;
-		wint_t p = peek;
-		peek = c;
+		uint8_t char_size;
+		wint_t c = utf8_decode_valid(lexer->stream + lexer->index, &char_size);
+		lexer->index += char_size;
+		wint_t p = lexer->peek;
+		lexer->peek = c;
 		return p;
 	}
 }
 
+// Whitespace check that skips the locale for ASCII
+bool lexer_is_space(wint_t c) {
+	return c < 0x80 ? scan_is_space_byte((uint8_t)c) : utf8_is_whitespace(c);
+}
+
+// Continue reading at the given offset, reloading peek from there
+void lexer_seek(lexer_t *lexer, size_t pos) {
+	lexer->index = pos;
+	lexer_read(lexer);
+}
+
+// Initialize a lexer on a buffer of len bytes already known to be valid
+// UTF-8, which must outlive it, and advance once to initialize peek. The
+// input ends at len or at a NUL byte.
+void lexer_init_valid(lexer_t *lexer, char *buf, size_t len) {
+	scan_init();
+
+	lexer->stream = buf;
+	lexer->length = len;
+	lexer->peek = WEOF;
+	lexer->lines = (line_index_t){ NULL, false };
+	lexer->origin = (source_loc_t){ 1, 1 };
+	lexer->owner = LEXER_BORROWED;
+	lexer_seek(lexer, 0);
+}
+
+// Initialize a lexer on a buffer as above, once it is checked to be valid
+void lexer_init_buffer(lexer_t *lexer, char *buf, size_t len) {
+	source_check_utf8(buf, len, (source_loc_t){ 1, 1 });
+	lexer_init_valid(lexer, buf, len);
+}
+
 // TODO: support Windows/ReactOS
-// Open file, initialize the lexer and advance once to initialize peek
-void lexer_init_file(char *path) {
+// Open file and initialize a lexer on it
+void lexer_init_file(lexer_t *lexer, char *path) {
 	int file = open(path, O_RDONLY);
 
 	if (file == -1) {
@@ -66,14 +216,43 @@ void lexer_init_file(char *path) {
 	}
 
 	off_t length = lseek(file, 0, SEEK_END);
-	lexer_stream = mmap(0, (size_t)length, PROT_READ, MAP_PRIVATE, file, 0);
 
-	if (lexer_stream == NULL) {
-		int err = errno;
-		error(err, "Failed to read file: %s", strerror(err));
+	// Empty files can't be mapped
+	if (length == 0) {
+		lexer_init_buffer(lexer, "", 0);
+	} else {
+		char *stream = mmap(0, (size_t)length, PROT_READ, MAP_PRIVATE, file, 0);
+
+		if (stream == MAP_FAILED) {
+			int err = errno;
+			error(err, "Failed to read file: %s", strerror(err));
+		}
+
+		lexer_init_buffer(lexer, stream, (size_t)length);
+		lexer->owner = LEXER_MAPPED;
 	}
-	// Initialize peek
-	lexer_read();
+
+	close(file);
+}
+
+// Location of a byte offset of the lexer's input
+source_loc_t lexer_location(lexer_t *lexer, size_t offset) {
+	source_loc_t loc = line_index_locate(&lexer->lines, lexer->stream, lexer->length, offset);
+
+	if (loc.line == 1)
+		loc.column += lexer->origin.column - 1;
+	loc.line += lexer->origin.line - 1;
+
+	return loc;
+}
+
+// Release the input of a lexer, tokens of it can't be read after this
+void lexer_close(lexer_t *lexer) {
+	if (lexer->owner == LEXER_MAPPED)
+		munmap(lexer->stream, lexer->length);
+
+	line_index_free(&lexer->lines);
+	lexer->stream = NULL;
 }
 
 typedef enum token_kind {
@@ -87,6 +266,8 @@ typedef enum token_kind {
 	TOKEN_EOF
 } token_kind_t;
 
+// Tokens span [start, end) of the lexer's stream. Strings and symbols carry no
+// value of their own, their text is only interned once the parser needs it.
 typedef struct token {
 	token_kind_t kind;
 
@@ -94,19 +275,27 @@ typedef struct token {
 	size_t end;
 
 	union {
-		char *string_val;
 		int64_t int_val;
 		double float_val;
-		char *symbol_val;
 	};
 } token_t;
 
+// Source text of a token in the stream it was lexed from, string literals
+// include their quotation marks
+char *token_text(char *stream, token_t token) {
+	return stream + token.start;
+}
+
+size_t token_len(token_t token) {
+	return token.end - token.start;
+}
+
 // Parse a single token and advance
-token_t lexer_next() {
+token_t lexer_next(lexer_t *lexer) {
 	token_t token;
-	token.start = lexer_index - 1;
+	token.start = lexer->peek_index;
 
-	wint_t c = lexer_read();
+	wint_t c = lexer_read(lexer);
 
 	switch (c) {
 		// End of file
@@ -129,19 +318,20 @@ token_t lexer_next() {
 		case '"':
 			token.kind = TOKEN_STRING;
 
-			while (peek != '"') {
-				if (peek == '\\')
-					lexer_read();
-				lexer_read();
+			while (lexer->peek != '"') {
+				if (lexer->peek == WEOF) {
+					source_loc_t loc = lexer_location(lexer, token.start);
+					error(1, "%zu:%zu: Unterminated string literal", loc.line, loc.column);
+				}
+				if (lexer->peek == '\\')
+					lexer_read(lexer);
+				lexer_read(lexer);
 			}
 
-			token.string_val = intern_range(lexer_stream + token.start, lexer_stream + lexer_index);
-			
-			lexer_read();
+			lexer_read(lexer);
 			
 			break;
-		// Integer
-		// TODO: parse floating point numbers
+		// Integer or float
 		case '0':
 		case '1':
 		case '2':
@@ -152,42 +342,314 @@ token_t lexer_next() {
 		case '7':
 		case '8':
 		case '9':
-			token.int_val = c - '0';
-			while (isdigit(peek)) {
-				token.int_val *= 10;
-				token.int_val += peek - '0';
-				c = lexer_read();
+		{
+			number_t num = number_parse(lexer->stream, token.start, lexer->length);
+
+			if (num.kind == NUMBER_ERROR) {
+				source_loc_t loc = lexer_location(lexer, token.start);
+				error(1, "%zu:%zu: %s", loc.line, loc.column, num.error);
+			} else if (num.kind == NUMBER_FLOAT) {
+				token.kind = TOKEN_FLOAT;
+				token.float_val = num.float_val;
+			} else {
+				token.kind = TOKEN_INT;
+				token.int_val = num.int_val;
 			}
 
-			token.kind = TOKEN_INT;
+			lexer_seek(lexer, num.end);
 			break;
+		}
 		// A symbol (any other valid UTF-8 character)
 		default:
-			if (utf8_is_whitespace(c)) {
+			if (lexer_is_space(c)) {
 				token.kind = TOKEN_SPACE;
-				while (utf8_is_whitespace(peek))
-					lexer_read();
+				for (;;) {
+					// Skip runs of ASCII whitespace in bulk
+					if (lexer->peek < 0x80 and scan_is_space_byte((uint8_t)lexer->peek))
+						lexer_seek(lexer, scan.space(lexer->stream, lexer->peek_index + 1, lexer->length));
+
+					if (!lexer_is_space(lexer->peek))
+						break;
+					lexer_read(lexer);
+				}
 			} else {
 				token.kind = TOKEN_SYMBOL;
-				while (
-					!utf8_is_whitespace(peek)
-					and peek != '(' 
-					and peek != '['
-					and peek != '{'
-					and peek != ')'
-					and peek != ']'
-					and peek != '}'
-					and peek != '"'
-				) {
-					lexer_read();
-				}
+				for (;;) {
+					// Skip runs of plain ASCII symbol characters in bulk
+					if (lexer->peek < 0x80 and scan_is_symbol_byte((uint8_t)lexer->peek))
+						lexer_seek(lexer, scan.symbol(lexer->stream, lexer->peek_index + 1, lexer->length));
 
-				token.symbol_val = intern_range(lexer_stream + token.start, lexer_stream + lexer_index - 1);
+					if (
+						lexer->peek == WEOF
+						or lexer_is_space(lexer->peek)
+						or lexer->peek == '(' 
+						or lexer->peek == '['
+						or lexer->peek == '{'
+						or lexer->peek == ')'
+						or lexer->peek == ']'
+						or lexer->peek == '}'
+						or lexer->peek == '"'
+					)
+						break;
+					lexer_read(lexer);
+				}
 			}
 			break;
 	}
 	
-	token.end = lexer_index - 1;
+	token.end = lexer->peek_index;
+
+	return token;
+}
+
+typedef union token_value {
+	int64_t int_val;
+	double float_val;
+} token_value_t;
+
+// A whole file worth of tokens as parallel arrays, whitespace excluded and
+// terminated by a TOKEN_EOF. The payload of a string or symbol is its length
+// in bytes, the payload of a number is the index of its value in values.
+typedef struct token_stream {
+	buffer_t(uint8_t) kinds;
+	buffer_t(uint32_t) offsets;
+	buffer_t(uint32_t) payloads;
+	buffer_t(token_value_t) values;
+
+	// Text the offsets refer to, owned by the lexer the tokens came from
+	char *source;
+	struct lexer *lexer;
+
+	// Read position of token_stream_next
+	size_t pos;
+} token_stream_t;
+
+// Lex the rest of the input into a stream
+token_stream_t lexer_tokenize(lexer_t *lexer) {
+	token_stream_t tokens = { 0 };
+	tokens.source = lexer->stream;
+	tokens.lexer = lexer;
+
+	if (lexer->length > UINT32_MAX)
+		error(1, "Input files larger than 4GB aren't supported");
+
+	for (;;) {
+		token_t token = lexer_next(lexer);
+		uint32_t payload = 0;
+
+		switch (token.kind) {
+			case TOKEN_SPACE:
+				continue;
+			case TOKEN_INT:
+				payload = (uint32_t)buffer_len(tokens.values);
+				buffer_push(tokens.values, (token_value_t){ .int_val = token.int_val });
+				break;
+			case TOKEN_FLOAT:
+				payload = (uint32_t)buffer_len(tokens.values);
+				buffer_push(tokens.values, (token_value_t){ .float_val = token.float_val });
+				break;
+			case TOKEN_STRING:
+			case TOKEN_SYMBOL:
+				payload = (uint32_t)token_len(token);
+				break;
+			default:
+				break;
+		}
+
+		buffer_push(tokens.kinds, (uint8_t)token.kind);
+		buffer_push(tokens.offsets, (uint32_t)token.start);
+		buffer_push(tokens.payloads, payload);
+
+		if (token.kind == TOKEN_EOF)
+			break;
+	}
+
+	return tokens;
+}
+
+// Unpack the i-th token of a stream, numbers only keep their value
+token_t token_stream_get(token_stream_t *tokens, size_t i) {
+	token_t token;
+	token.kind = tokens->kinds[i];
+	token.start = tokens->offsets[i];
+	token.end = token.start;
+
+	switch (token.kind) {
+		case TOKEN_INT:
+			token.int_val = tokens->values[tokens->payloads[i]].int_val;
+			break;
+		case TOKEN_FLOAT:
+			token.float_val = tokens->values[tokens->payloads[i]].float_val;
+			break;
+		case TOKEN_STRING:
+		case TOKEN_SYMBOL:
+			token.end = token.start + tokens->payloads[i];
+			break;
+		default:
+			break;
+	}
+
+	return token;
+}
+
+// Take the token at the read position and advance, staying on the final EOF
+token_t token_stream_next(token_stream_t *tokens) {
+	token_t token = token_stream_get(tokens, tokens->pos);
+
+	if (token.kind != TOKEN_EOF)
+		tokens->pos++;
 
 	return token;
 }
+
+// Location of a token, the lexer it came from must still be open
+source_loc_t token_location(token_stream_t *tokens, token_t token) {
+	return lexer_location(tokens->lexer, token.start);
+}
+
+size_t token_stream_len(token_stream_t *tokens) {
+	return buffer_len(tokens->kinds);
+}
+
+void token_stream_free(token_stream_t *tokens) {
+	buffer_free(tokens->kinds);
+	buffer_free(tokens->offsets);
+	buffer_free(tokens->payloads);
+	buffer_free(tokens->values);
+}
+
+// Locations from the line index must match counting from the start
+test_result_t line_index_test() {
+	char *s =
+		"(func main [] I32 {\n"
+		"\n"
+		"\t(printf \"héllo wörld\\n\")\n"
+		"\t(return 0)\n"
+		"})";
+	size_t len = strlen(s);
+
+	lexer_t lexer;
+	lexer_init_buffer(&lexer, s, len);
+
+	size_t line = 1;
+	size_t column = 1;
+
+	for (size_t i = 0; i <= len; i++) {
+		source_loc_t loc = lexer_location(&lexer, i);
+
+		// Only codepoint boundaries have a location of their own
+		if (i == len or ((uint8_t)s[i] & 0xc0) != 0x80) {
+			if (loc.line != line or loc.column != column)
+				return test_fail("Offset %zu is at %zu:%zu, expected %zu:%zu", i, loc.line, loc.column, line, column);
+
+			if (i < len and s[i] == '\n') {
+				line++;
+				column = 1;
+			} else {
+				column++;
+			}
+		}
+	}
+
+	lexer_close(&lexer);
+	return test_pass();
+}
+
+// Generate about 16MB of source for benchmarks, NUL terminated
+char *lexer_bench_source(size_t *len) {
+	char *snippet =
+		"(func some_function_name [ (first_argument I64) (second_argument (@ U8)) ] I64 {\n"
+		"\t(let intermediate_value (+ first_argument (* 12345 67)))\n"
+		"\t(printf \"a string literal %lld\\n\" intermediate_value)\n"
+		"\t(return (call_another_function intermediate_value second_argument))\n"
+		"})\n\n";
+	size_t snippet_len = strlen(snippet);
+	size_t reps = (16 << 20) / snippet_len;
+	*len = reps * snippet_len;
+
+	char *buf = malloc(*len + 1);
+	for (size_t i = 0; i < reps; i++)
+		memcpy(buf + i*snippet_len, snippet, snippet_len);
+	buf[*len] = 0;
+
+	return buf;
+}
+
+// Lexing throughput of a generated source for every scanner implementation
+void lexer_bench() {
+	size_t len;
+	char *buf = lexer_bench_source(&len);
+
+	scan_init();
+	scan_impl_t selected = scan;
+
+	for (size_t i = 0; scan_impls[i].name != NULL; i++) {
+		if (!scan_supported(scan_impls[i]))
+			continue;
+
+		scan = scan_impls[i];
+		lexer_t lexer;
+		lexer_init_buffer(&lexer, buf, len);
+
+		uint64_t start = bench_now();
+		token_stream_t tokens = lexer_tokenize(&lexer);
+		uint64_t elapsed = bench_now() - start;
+
+		printf(
+			"lexer %-6s: %8.1f MB/s, %zu tokens\n",
+			scan_impls[i].name, (double)len / 1e6 / ((double)elapsed / 1e9), token_stream_len(&tokens)
+		);
+		token_stream_free(&tokens);
+	}
+
+	scan = selected;
+	free(buf);
+}
+
+// Lexing throughput of a table of numeric literals, the kind of input that
+// is mostly integers and floats
+void lexer_number_bench() {
+	buffer_t(char) source = NULL;
+	uint64_t state = 5;
+	size_t literals = 0;
+
+	while (buffer_len(source) < (16 << 20)) {
+		buffer_push(source, '(');
+
+		for (size_t i = 0; i < 8; i++, literals++) {
+			state = state * 6364136223846793005U + 1442695040888963407U;
+			uint64_t r = state >> 16;
+			char item[64];
+			int n;
+
+			switch (i % 4) {
+				case 0:  n = sprintf(item, " %lu", (unsigned long)(r % 100000000000U)); break;
+				case 1:  n = sprintf(item, " %lu.%03lu", (unsigned long)(r % 100000), (unsigned long)(r >> 32) % 1000); break;
+				case 2:  n = sprintf(item, " %.17g", (double)(r % 1000000) * 1e-9); break;
+				default: n = sprintf(item, " 0x%lx", (unsigned long)(r % 0xffffffffU)); break;
+			}
+
+			for (int c = 0; c < n; c++)
+				buffer_push(source, item[c]);
+		}
+
+		buffer_push(source, ')');
+		buffer_push(source, '\n');
+	}
+
+	lexer_t lexer;
+	lexer_init_buffer(&lexer, source, buffer_len(source));
+
+	uint64_t start = bench_now();
+	token_stream_t tokens = lexer_tokenize(&lexer);
+	uint64_t elapsed = bench_now() - start;
+
+	printf(
+		"numbers: %8.1f MB/s, %6.1f M literals/s\n",
+		(double)buffer_len(source) / 1e6 / ((double)elapsed / 1e9),
+		(double)literals / 1e6 / ((double)elapsed / 1e9)
+	);
+
+	token_stream_free(&tokens);
+	buffer_free(source);
+}
@@ -0,0 +1,403 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#pragma once
+
+// Parsing of one input on several threads. A pre-scan splits the input
+// between top-level forms, every thread lexes and parses its share into
+// its own arenas, and the results are joined in source order.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <iso646.h>
+
+#include <utils/buffer.h>
+#include <utils/arena.h>
+#include <utils/bench.h>
+#include <utils/test.h>
+#include <utils/misc.h>
+
+#include <frontend/symbols.h>
+#include <frontend/scan.h>
+#include <frontend/lexer.h>
+#include <frontend/parser.h>
+#include <frontend/ast.h>
+#include <frontend/direct-parse.h>
+
+// Inputs smaller than this per thread aren't worth splitting further
+#define PARSE_MIN_CHUNK (64 * 1024)
+
+// State of a scan for top-level forms, which tracks the paren depth and
+// skips string literals. Input can be fed to it in parts.
+typedef struct form_scan {
+	size_t depth;
+	bool in_string;
+	// The last part ended on a backslash in a string
+	bool escaped;
+
+	// Offsets of the top-level forms found so far, and the offset just past
+	// the last one that was closed
+	buffer_t(size_t) starts;
+	size_t complete;
+} form_scan_t;
+
+// Continue a scan over s[pos..len)
+void form_scan(form_scan_t *state, const char *s, size_t pos, size_t len) {
+	scan_init();
+
+	if (state->escaped and pos < len) {
+		state->escaped = false;
+		pos++;
+	}
+
+	while ((pos = scan.structural(s, pos, len)) < len) {
+		if (state->in_string) {
+			// Continuation bytes are never structural, so skipping the
+			// first byte of an escaped codepoint is enough
+			if (s[pos] == '\\') {
+				if (pos + 1 < len)
+					pos++;
+				else
+					state->escaped = true;
+			} else if (s[pos] == '"') {
+				state->in_string = false;
+			}
+
+			pos++;
+			continue;
+		}
+
+		switch (s[pos]) {
+			case '(':
+			case '[':
+			case '{':
+				if (state->depth == 0)
+					buffer_push(state->starts, pos);
+				state->depth++;
+				break;
+			case ')':
+			case ']':
+			case '}':
+				if (state->depth > 0 and --state->depth == 0)
+					state->complete = pos + 1;
+				break;
+			case '"':
+				state->in_string = true;
+				break;
+			default:
+				break;
+		}
+		pos++;
+	}
+}
+
+// Offsets of the top-level forms of an input
+buffer_t(size_t) parse_find_forms(const char *s, size_t len) {
+	form_scan_t state = { 0 };
+	form_scan(&state, s, 0, len);
+	return state.starts;
+}
+
+// One share of the input, along with everything parsed from it. Shares are
+// ranges of the whole input, so token offsets and locations stay absolute.
+typedef struct parse_worker {
+	char *source;
+	size_t start;
+	size_t end;
+	// Location of the first byte of source
+	source_loc_t origin;
+
+	ast_program_t program;
+	arena_t ast_arena;
+	arena_t type_arena;
+	// Message of the error that stopped parsing the share, if any
+	char *error;
+} parse_worker_t;
+
+// Parse a share. Errors are trapped, so that the one reported is the first
+// in the source rather than whichever thread got there first.
+void *parse_worker(void *arg) {
+	parse_worker_t *worker = arg;
+	jmp_buf *outer = error_trap;
+	jmp_buf trap;
+
+	if (setjmp(trap) == 0) {
+		error_trap = &trap;
+		lexer_t lexer;
+
+		// Callers check the whole input is valid UTF-8 once, not every share
+		lexer_init_valid(&lexer, worker->source, worker->end);
+		lexer.origin = worker->origin;
+		lexer_seek(&lexer, worker->start);
+		token_stream_t tokens = lexer_tokenize(&lexer);
+
+		worker->program = parse_direct(&tokens);
+		token_stream_free(&tokens);
+		lexer_close(&lexer);
+	} else {
+		worker->error = error_message;
+	}
+
+	error_trap = outer;
+
+	// Hand the AST over before this thread's arenas go away
+	worker->ast_arena = ast_arena;
+	worker->type_arena = type_arena;
+	ast_arena = (arena_t){ NULL, 0, 0 };
+	type_arena = (arena_t){ NULL, 0, 0 };
+
+	return NULL;
+}
+
+// Lex and parse the input of a lexer on up to threads threads
+ast_program_t parse_parallel(lexer_t *lexer, size_t threads) {
+	// Offsets of forms are relative to where the lexer is at
+	size_t base = lexer->peek_index;
+	size_t len = lexer->length - base;
+
+	buffer_t(size_t) forms = parse_find_forms(lexer->stream + base, len);
+
+	if (threads > len / PARSE_MIN_CHUNK + 1)
+		threads = len / PARSE_MIN_CHUNK + 1;
+	if (threads > buffer_len(forms))
+		threads = MAX(1, buffer_len(forms));
+
+	log_info("Parsing %zu top-level forms on %zu threads", buffer_len(forms), threads);
+
+	// Split at the first form starting past each thread's even share
+	parse_worker_t workers[threads];
+	size_t form = 0;
+	size_t start = 0;
+
+	for (size_t t = 0; t < threads; t++) {
+		size_t end = len;
+
+		if (t + 1 < threads) {
+			while (form < buffer_len(forms) and forms[form] < (t + 1) * (len / threads))
+				form++;
+			end = form < buffer_len(forms) ? MAX(start, forms[form]) : len;
+		}
+
+		workers[t] = (parse_worker_t){ lexer->stream, base + start, base + end, lexer->origin, { NULL }, { 0 }, { 0 }, NULL };
+		start = end;
+	}
+
+	buffer_free(forms);
+
+	// The calling thread parses the first share itself
+	pthread_t ids[threads];
+
+	for (size_t t = 1; t < threads; t++)
+		if (pthread_create(ids + t, NULL, parse_worker, workers + t) != 0)
+			error(1, "Failed to start parser thread");
+
+	parse_worker(workers);
+
+	for (size_t t = 1; t < threads; t++)
+		pthread_join(ids[t], NULL);
+
+	// Shares are in source order, so the first to fail has the first error
+	for (size_t t = 0; t < threads; t++)
+		if (workers[t].error != NULL)
+			error(1, "%s", workers[t].error);
+
+	// Join the items in source order, the arenas now belong to this thread
+	ast_program_t prog = { NULL };
+	size_t items = 0;
+
+	for (size_t t = 0; t < threads; t++) {
+		arena_merge(&ast_arena, &workers[t].ast_arena);
+		arena_merge(&type_arena, &workers[t].type_arena);
+		items += buffer_len(workers[t].program.items);
+	}
+
+	buffer_fit_arena(&ast_arena, prog.items, items);
+
+	for (size_t t = 0; t < threads; t++) {
+		size_t n = buffer_len(workers[t].program.items);
+
+		if (n != 0) {
+			memcpy(prog.items + buffer_len(prog.items), workers[t].program.items, n * sizeof(ast_tl_t));
+			buffer__hdr(prog.items)->len += n;
+		}
+	}
+
+	return prog;
+}
+
+// Generate a source of count functions, NUL terminated
+char *parse_parallel_source(size_t count, size_t *len) {
+	buffer_t(char) source = NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		char *item = heap_fmt(
+			"(func f%zu [ (a I64) (b (@ U8)) ] I64 {\n"
+			"\t(let x (+ a (* %zu 3)))\n"
+			"\t(printf \"(%zu) \\\" [\\n\" x)\n"
+			"\t(while (> a 0) { (set a (- a 1)) })\n"
+			"\t(return (+ x a))\n"
+			"})\n",
+			i, i, i
+		);
+
+		for (char *c = item; *c; c++)
+			buffer_push(source, *c);
+		free(item);
+	}
+
+	*len = buffer_len(source);
+	buffer_push(source, 0);
+
+	char *out = malloc(*len + 1);
+	memcpy(out, source, *len + 1);
+	buffer_free(source);
+	return out;
+}
+
+// Parsing on several threads must give the same program as parsing on one
+test_result_t parse_parallel_test() {
+	size_t len;
+	char *source = parse_parallel_source(20000, &len);
+
+	buffer_t(size_t) forms = parse_find_forms(source, len);
+	if (buffer_len(forms) != 20000)
+		return test_fail("Found %zu top-level forms, expected 20000", buffer_len(forms));
+	buffer_free(forms);
+
+	lexer_t lexer;
+	lexer_init_buffer(&lexer, source, len);
+	ast_program_t expect = parse_parallel(&lexer, 1);
+
+	lexer_init_buffer(&lexer, source, len);
+	ast_program_t got = parse_parallel(&lexer, 4);
+
+	if (buffer_len(got.items) != buffer_len(expect.items))
+		return test_fail("Parsed %zu items, expected %zu", buffer_len(got.items), buffer_len(expect.items));
+
+	for (size_t i = 0; i < buffer_len(got.items); i++) {
+		ast_tl_t a = got.items[i];
+		ast_tl_t b = expect.items[i];
+
+		if (
+			a.kind != b.kind
+			or a.func.name != b.func.name
+			or buffer_len(a.func.args) != buffer_len(b.func.args)
+			or buffer_len(a.func.body) != buffer_len(b.func.body)
+		)
+			return test_fail("Item %zu differs", i);
+	}
+
+	arena_free(&ast_arena);
+	arena_free(&type_arena);
+	free(source);
+	return test_pass();
+}
+
+// Parse a source on a number of threads, giving the error reported
+char *parse_parallel_error(char *source, size_t len, size_t threads) {
+	lexer_t lexer;
+	jmp_buf trap;
+	char *message = NULL;
+
+	lexer_init_buffer(&lexer, source, len);
+
+	if (setjmp(trap) == 0) {
+		error_trap = &trap;
+		parse_parallel(&lexer, threads);
+	} else {
+		message = error_message;
+	}
+
+	error_trap = NULL;
+	return message;
+}
+
+// With errors in several shares, the first in the source is reported
+// however many threads parse it
+test_result_t parse_parallel_error_test() {
+	size_t len;
+	char *source = parse_parallel_source(20000, &len);
+	char *ret = "(return (+ x a))";
+	char *bad = "(return 1 2 3 4)";
+	size_t failing[] = { 5000, 15000 };
+	char *at = source;
+
+	// Break the returns of two functions far apart, keeping every offset
+	for (size_t i = 0, f = 0; f < 2; i++) {
+		at = strstr(at, ret);
+
+		if (i == failing[f]) {
+			memcpy(at, bad, strlen(bad));
+			f++;
+		}
+
+		at += strlen(ret);
+	}
+
+	char *expect = parse_parallel_error(source, len, 1);
+
+	if (expect == NULL)
+		return test_fail("Parsing on one thread didn't fail");
+
+	for (size_t threads = 2; threads <= 8; threads *= 2) {
+		char *got = parse_parallel_error(source, len, threads);
+
+		if (got == NULL or strcmp(got, expect) != 0)
+			return test_fail("On %zu threads got error '%s', expected '%s'", threads, got, expect);
+	}
+
+	arena_free(&ast_arena);
+	arena_free(&type_arena);
+	free(source);
+	return test_pass();
+}
+
+// Parsing time of a large generated input on 1 to 16 threads
+void parse_parallel_bench() {
+	size_t len;
+	char *source = parse_parallel_source(100000, &len);
+	uint64_t single = 0;
+
+	// Other benchmarks may have reset the interner, keywords must come first
+	intern_free();
+	symbols_init();
+
+	for (size_t threads = 1; threads <= 16; threads *= 2) {
+		lexer_t lexer;
+		lexer_init_buffer(&lexer, source, len);
+
+		uint64_t start = bench_now();
+		parse_parallel(&lexer, threads);
+		uint64_t elapsed = bench_now() - start;
+
+		if (threads == 1)
+			single = elapsed;
+
+		printf(
+			"parse %2zu threads: %8.1f ms, %5.2fx\n",
+			threads, (double)elapsed / 1e6, (double)single / (double)elapsed
+		);
+
+		arena_free(&ast_arena);
+		arena_free(&type_arena);
+	}
+
+	free(source);
+}
@@ -21,13 +21,18 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <iso646.h>
+#include <pthread.h>
 
 #include <utils/intern.h>
 #include <utils/buffer.h>
+#include <utils/arena.h>
 #include <utils/log.h>
+#include <utils/bench.h>
 #include <utils/misc.h>
+#include <utils/test.h>
 
 #include <frontend/lexer.h>
+#include <frontend/symbols.h>
 
 typedef enum atom_kind {
 	ATOM_INTEGER,
@@ -37,6 +42,8 @@ typedef enum atom_kind {
 	ATOM_EXPR
 } atom_kind_t;
 
+// Lists don't own their items, they refer to a range of the pool they were
+// parsed into, see atom_pool_t
 typedef struct atom {
 	atom_kind_t kind;
 
@@ -45,10 +52,51 @@ typedef struct atom {
 		double float_val;
 		char *symbol_val;
 		char *string_val;
-		buffer_t(struct atom) expr;
+		struct {
+			uint32_t first;
+			uint32_t count;
+		} list;
 	};
 } atom_t;
 
+// A list still being parsed: where its items start on the stack of its pool,
+// and the paren that opened it
+typedef struct parse_frame {
+	size_t base;
+	token_t open;
+} parse_frame_t;
+
+// Flat storage for every atom of a file. The items of each list are stored
+// contiguously, so walking a list is a linear scan of one array. Only needed
+// until the AST has been built.
+typedef struct atom_pool {
+	buffer_t(atom_t) atoms;
+	// Items of the lists still being parsed, and the lists themselves
+	buffer_t(atom_t) stack;
+	buffer_t(parse_frame_t) frames;
+} atom_pool_t;
+
+// Number of items in a list, 0 for any other atom
+size_t atom_len(atom_t atom) {
+	return atom.kind == ATOM_EXPR ? atom.list.count : 0;
+}
+
+// Get the i-th item of a list
+atom_t atom_at(atom_pool_t *pool, atom_t list, size_t i) {
+	if (list.kind != ATOM_EXPR)
+		error(1, "Expected expression, found atom");
+	if (i >= list.list.count)
+		error(1, "Expected at least %zu items in expression, found %u", i + 1, list.list.count);
+
+	return pool->atoms[list.list.first + i];
+}
+
+void atom_pool_free(atom_pool_t *pool) {
+	buffer_free(pool->atoms);
+	buffer_free(pool->stack);
+	buffer_free(pool->frames);
+}
+
 // Check if atom is a symbol and, if name != NULL, if it is equal to the name provided
 bool is_symbol(atom_t expr, char *name) {
 	if (name == NULL)
@@ -57,8 +105,13 @@ bool is_symbol(atom_t expr, char *name) {
 		return expr.kind == ATOM_SYMBOL and strcmp(expr.symbol_val, name) == 0;
 }
 
+// Check if atom is the given keyword, by interned ID rather than by name
+bool is_keyword(atom_t expr, sym_kind_t keyword) {
+	return expr.kind == ATOM_SYMBOL and intern_id(expr.symbol_val) == keyword;
+}
+
 // Print out an atom (for debugging only)
-void print_expr(atom_t atom) {
+void print_expr(atom_pool_t *pool, atom_t atom) {
 	switch (atom.kind) {
 		case ATOM_INTEGER:
 			log_trace("Integer (%ld) ", atom.integer_val);
@@ -74,73 +127,97 @@ void print_expr(atom_t atom) {
 			break;
 		case ATOM_EXPR:
 			log_trace("Begin expression");
-			for (size_t i = 0; i < buffer_len(atom.expr); i++)
-				print_expr(atom.expr[i]);
+			for (size_t i = 0; i < atom_len(atom); i++)
+				print_expr(pool, atom_at(pool, atom, i));
 			log_trace("End expression");
 
 			break;
 	}
 }
 
-// Take next token, skipping whitespace
-token_t parser_next() {
-	token_t next = lexer_next();
-	if (next.kind == TOKEN_SPACE)
-		next = lexer_next();
-	return next;
+atom_t parse_item(atom_pool_t *, token_stream_t *, token_t);
+
+// Move the items pushed to the stack since base into the pool as one list
+atom_t parse_close_list(atom_pool_t *pool, size_t base) {
+	size_t count = buffer_len(pool->stack) - base;
+	size_t first = buffer_len(pool->atoms);
+
+	if (first + count > UINT32_MAX)
+		error(1, "Input has too many atoms");
+
+	if (count != 0) {
+		buffer_fit(pool->atoms, first + count);
+		memcpy(pool->atoms + first, pool->stack + base, count*sizeof(atom_t));
+		buffer__hdr(pool->atoms)->len += count;
+	}
+
+	if (pool->stack)
+		buffer__hdr(pool->stack)->len = base;
+
+	atom_t list;
+	list.kind = ATOM_EXPR;
+	list.list.first = (uint32_t)first;
+	list.list.count = (uint32_t)count;
+	return list;
 }
 
-atom_t parse_item(token_t);
+// Parse an expression, open is its opening paren. Lists nested in it are
+// tracked on the pool's frames rather than by recursing, so nesting depth is
+// only limited by memory.
+atom_t parse_expr(atom_pool_t *pool, token_stream_t *tokens, token_t open) {
+	size_t depth = buffer_len(pool->frames);
+	buffer_push(pool->frames, (parse_frame_t){ buffer_len(pool->stack), open });
 
-// Parse an expression
-atom_t parse_expr() {
-	atom_t expr;
-	expr.kind = ATOM_EXPR;
-	expr.expr = NULL;
-	
 	for (;;) {
-		token_t next = parser_next();
+		token_t next = token_stream_next(tokens);
 
-		if (next.kind == TOKEN_EOF)
-			error(1, "Expected ')', found EOF");
-		else if (next.kind == TOKEN_RPAREN)
-			break;
+		if (next.kind == TOKEN_EOF) {
+			parse_frame_t innermost = pool->frames[buffer_len(pool->frames) - 1];
+			source_loc_t loc = token_location(tokens, innermost.open);
+			error(1, "%zu:%zu: Expected ')' to close this expression, found EOF", loc.line, loc.column);
+		} else if (next.kind == TOKEN_LPAREN) {
+			buffer_push(pool->frames, (parse_frame_t){ buffer_len(pool->stack), next });
+		} else if (next.kind == TOKEN_RPAREN) {
+			atom_t list = parse_close_list(pool, pool->frames[--buffer__hdr(pool->frames)->len].base);
 
-		buffer_push(expr.expr, parse_item(next));
-	}
+			if (buffer_len(pool->frames) == depth)
+				return list;
 
-	return expr;
+			buffer_push(pool->stack, list);
+		} else {
+			buffer_push(pool->stack, parse_item(pool, tokens, next));
+		}
+	}
 }
 
 // Parse a top-level file (the same as parsing an expression except without the ending ')')
-atom_t parse() {
+atom_t parse(atom_pool_t *pool, token_stream_t *tokens) {
 	log_info("Begin parsing");
-	atom_t atom;
-	atom.kind = ATOM_EXPR;
-	atom.expr = NULL;
+	size_t base = buffer_len(pool->stack);
 
 	for (;;) {
-		token_t next = parser_next();
+		token_t next = token_stream_next(tokens);
 
 		if (next.kind == TOKEN_EOF)
 			break;
 
-		atom_t expr = parse_item(next);
-		buffer_push(atom.expr, expr);
+		atom_t expr = parse_item(pool, tokens, next);
+		buffer_push(pool->stack, expr);
 	}
 
+	atom_t atom = parse_close_list(pool, base);
 	log_info("Parsing complete");
 
 	return atom;
 }
 
 // Parse individual item
-atom_t parse_item(token_t next) {
+atom_t parse_item(atom_pool_t *pool, token_stream_t *tokens, token_t next) {
 	atom_t atom;
 	
 	switch (next.kind) {
 		case TOKEN_LPAREN: 
-			atom = parse_expr(TOKEN_LPAREN); 
+			atom = parse_expr(pool, tokens, next); 
 			break;
 		case TOKEN_INT: 
 			atom.kind = ATOM_INTEGER;
@@ -152,24 +229,125 @@ atom_t parse_item(token_t next) {
 			break;
 		case TOKEN_STRING: 
 			atom.kind = ATOM_STRING;
-			char *str = next.string_val;
+			char *str = token_text(tokens->source, next);
+			size_t len = token_len(next);
 
 			// Make sure the string is valid (starts and ends with a quotation mark)
-			assert(str[0] == '"');
-			assert(str[strlen(str) - 1] == '"');
+			assert(len >= 2 and str[0] == '"' and str[len - 1] == '"');
 
-			// Reallocate the string, excluding the start and end '"'
-			// TODO: make this more efficient (somehow)
-			atom.string_val = intern_range(str + 1, str + strlen(str) - 1);
+			// Intern the string, excluding the start and end '"'
+			atom.string_val = intern_range(str + 1, str + len - 1);
 			break;
 		case TOKEN_SYMBOL: 
 			atom.kind = ATOM_SYMBOL;
-			atom.symbol_val = next.symbol_val;
+			char *text = token_text(tokens->source, next);
+			atom.symbol_val = intern_range(text, text + token_len(next));
 			break;
 
-		default:
-			error(1, "Unhandled token kind: %d", next.kind);
+		default: {
+			source_loc_t loc = token_location(tokens, next);
+			error(1, "%zu:%zu: Unhandled token kind: %d", loc.line, loc.column, next.kind);
+		}
 	}
 
 	return atom;
 }
+
+// Parsing throughput from an already lexed stream, so it can be measured
+// apart from the lexer
+void parser_bench() {
+	size_t len;
+	char *buf = lexer_bench_source(&len);
+
+	lexer_t lexer;
+	lexer_init_buffer(&lexer, buf, len);
+	token_stream_t tokens = lexer_tokenize(&lexer);
+
+	size_t reps = 5;
+	uint64_t start = bench_now();
+	for (size_t i = 0; i < reps; i++) {
+		atom_pool_t pool = { 0 };
+		tokens.pos = 0;
+		parse(&pool, &tokens);
+		atom_pool_free(&pool);
+	}
+	uint64_t elapsed = (bench_now() - start) / reps;
+
+	printf(
+		"parser: %8.1f MB/s, %6.1f Mtokens/s\n",
+		(double)len / 1e6 / ((double)elapsed / 1e9),
+		(double)token_stream_len(&tokens) / 1e6 / ((double)elapsed / 1e9)
+	);
+
+	token_stream_free(&tokens);
+	free(buf);
+}
+
+// One input of parser_mt_test, lexed and parsed with its own lexer and pool
+typedef struct parser_worker {
+	char *source;
+	atom_pool_t pool;
+	atom_t program;
+} parser_worker_t;
+
+void *parser_worker(void *arg) {
+	parser_worker_t *worker = arg;
+	lexer_t lexer;
+
+	lexer_init_buffer(&lexer, worker->source, strlen(worker->source));
+	token_stream_t tokens = lexer_tokenize(&lexer);
+	worker->program = parse(&worker->pool, &tokens);
+
+	token_stream_free(&tokens);
+	lexer_close(&lexer);
+	return NULL;
+}
+
+// Parse different sources at once, the atoms must match parsing them one by one
+test_result_t parser_mt_test() {
+	size_t threads = 4;
+	parser_worker_t workers[threads];
+	parser_worker_t expect[threads];
+	pthread_t ids[threads];
+
+	for (size_t t = 0; t < threads; t++) {
+		char *source = NULL;
+
+		for (size_t i = 0; i < 500; i++) {
+			char *item = heap_fmt("(func t%zu_f%zu [ (a I64) ] I64 { (return (+ a %zu \"s%zu\")) })\n", t, i, i, t);
+			for (char *c = item; *c; c++)
+				buffer_push(source, *c);
+			free(item);
+		}
+		buffer_push(source, 0);
+
+		workers[t] = (parser_worker_t){ source, { 0 }, { 0 } };
+		expect[t] = workers[t];
+		parser_worker(expect + t);
+	}
+
+	for (size_t t = 0; t < threads; t++)
+		if (pthread_create(ids + t, NULL, parser_worker, workers + t) != 0)
+			error(1, "Failed to start parser thread");
+
+	for (size_t t = 0; t < threads; t++)
+		pthread_join(ids[t], NULL);
+
+	for (size_t t = 0; t < threads; t++) {
+		atom_pool_t *got = &workers[t].pool;
+		atom_pool_t *want = &expect[t].pool;
+
+		if (buffer_len(got->atoms) != buffer_len(want->atoms))
+			return test_fail("Thread %zu parsed %zu atoms, expected %zu", t, buffer_len(got->atoms), buffer_len(want->atoms));
+
+		for (size_t i = 0; i < buffer_len(got->atoms); i++)
+			if (got->atoms[i].kind != want->atoms[i].kind or got->atoms[i].integer_val != want->atoms[i].integer_val)
+				return test_fail("Thread %zu differs at atom %zu", t, i);
+
+		atom_pool_free(got);
+		atom_pool_free(want);
+		buffer_free(workers[t].source);
+	}
+
+	return test_pass();
+}
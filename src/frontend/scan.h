@@ -0,0 +1,684 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#pragma once
+
+// Bulk scanning of the ASCII byte runs that make up most of a source file.
+// The scanners only skip bytes they know the class of, anything else (every
+// non-ASCII byte included) is left for the Unicode-aware path in lexer_next.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iso646.h>
+#include <pthread.h>
+
+#include <utils/test.h>
+#include <utils/bench.h>
+#include <utils/utf8.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+// Printable ASCII that isn't a delimiter or a quotation mark
+bool scan_is_symbol_byte(uint8_t c) {
+	return c > 0x20 and c < 0x7f
+		and c != '(' and c != ')'
+		and c != '[' and c != ']'
+		and c != '{' and c != '}'
+		and c != '"';
+}
+
+// ASCII whitespace, the same set utf8_is_whitespace accepts below 0x80
+bool scan_is_space_byte(uint8_t c) {
+	return c == ' ' or (c >= 0x09 and c <= 0x0d);
+}
+
+// Bytes that open or close a form or matter inside string literals
+bool scan_is_structural_byte(uint8_t c) {
+	return c == '(' or c == ')'
+		or c == '[' or c == ']'
+		or c == '{' or c == '}'
+		or c == '"' or c == '\\';
+}
+
+// Index of the first byte in [pos, len) that isn't a symbol byte, len if none
+size_t scan_symbol_scalar(const char *s, size_t pos, size_t len) {
+	while (pos < len and scan_is_symbol_byte((uint8_t)s[pos]))
+		pos++;
+	return pos;
+}
+
+// Index of the first byte in [pos, len) that isn't whitespace, len if none
+size_t scan_space_scalar(const char *s, size_t pos, size_t len) {
+	while (pos < len and scan_is_space_byte((uint8_t)s[pos]))
+		pos++;
+	return pos;
+}
+
+// Index of the first structural byte in [pos, len), len if none
+size_t scan_structural_scalar(const char *s, size_t pos, size_t len) {
+	while (pos < len and !scan_is_structural_byte((uint8_t)s[pos]))
+		pos++;
+	return pos;
+}
+
+// Index of the first newline in [pos, len), len if none
+size_t scan_newline_scalar(const char *s, size_t pos, size_t len) {
+	while (pos < len and s[pos] != '\n')
+		pos++;
+	return pos;
+}
+
+// Whether s[0..len) is valid UTF-8
+bool scan_utf8_scalar(const char *s, size_t len) {
+	return utf8_validate(s, len) == len;
+}
+
+#ifdef SCAN_X86
+
+// Vector versions of the byte classes above. Comparisons are signed, so
+// every byte >= 0x80 falls outside of both classes.
+__m128i scan_symbol_mask_sse2(__m128i v) {
+	__m128i printable = _mm_and_si128(
+		_mm_cmpgt_epi8(v, _mm_set1_epi8(0x20)),
+		_mm_cmplt_epi8(v, _mm_set1_epi8(0x7f))
+	);
+
+	// '(' and ')' differ in the lowest bit, '[' and '{', ']' and '}' in bit 5
+	__m128i folded = _mm_and_si128(v, _mm_set1_epi8((char)0xdf));
+	__m128i delim = _mm_or_si128(
+		_mm_or_si128(
+			_mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(1)), _mm_set1_epi8(')')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))
+		),
+		_mm_or_si128(
+			_mm_cmpeq_epi8(folded, _mm_set1_epi8('[')),
+			_mm_cmpeq_epi8(folded, _mm_set1_epi8(']'))
+		)
+	);
+
+	return _mm_andnot_si128(delim, printable);
+}
+
+__m128i scan_space_mask_sse2(__m128i v) {
+	return _mm_or_si128(
+		_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+		_mm_and_si128(
+			_mm_cmpgt_epi8(v, _mm_set1_epi8(0x08)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8(0x0e))
+		)
+	);
+}
+
+__m128i scan_structural_mask_sse2(__m128i v) {
+	__m128i folded = _mm_and_si128(v, _mm_set1_epi8((char)0xdf));
+	return _mm_or_si128(
+		_mm_or_si128(
+			_mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(1)), _mm_set1_epi8(')')),
+			_mm_or_si128(
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))
+			)
+		),
+		_mm_or_si128(
+			_mm_cmpeq_epi8(folded, _mm_set1_epi8('[')),
+			_mm_cmpeq_epi8(folded, _mm_set1_epi8(']'))
+		)
+	);
+}
+
+size_t scan_symbol_sse2(const char *s, size_t pos, size_t len) {
+	while (pos + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + pos));
+		unsigned mask = (unsigned)_mm_movemask_epi8(scan_symbol_mask_sse2(v));
+
+		if (mask != 0xffff)
+			return pos + (size_t)__builtin_ctz(~mask);
+		pos += 16;
+	}
+	return scan_symbol_scalar(s, pos, len);
+}
+
+size_t scan_space_sse2(const char *s, size_t pos, size_t len) {
+	while (pos + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + pos));
+		unsigned mask = (unsigned)_mm_movemask_epi8(scan_space_mask_sse2(v));
+
+		if (mask != 0xffff)
+			return pos + (size_t)__builtin_ctz(~mask);
+		pos += 16;
+	}
+	return scan_space_scalar(s, pos, len);
+}
+
+size_t scan_structural_sse2(const char *s, size_t pos, size_t len) {
+	while (pos + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + pos));
+		unsigned mask = (unsigned)_mm_movemask_epi8(scan_structural_mask_sse2(v));
+
+		if (mask != 0)
+			return pos + (size_t)__builtin_ctz(mask);
+		pos += 16;
+	}
+	return scan_structural_scalar(s, pos, len);
+}
+
+size_t scan_newline_sse2(const char *s, size_t pos, size_t len) {
+	while (pos + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + pos));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+
+		if (mask != 0)
+			return pos + (size_t)__builtin_ctz(mask);
+		pos += 16;
+	}
+	return scan_newline_scalar(s, pos, len);
+}
+
+// There's no byte shuffle before SSSE3 for the lookup tables used below, so
+// this only skips ASCII runs in bulk
+bool scan_utf8_sse2(const char *s, size_t len) {
+	size_t pos = 0;
+
+	while (pos < len) {
+		if (pos + 16 <= len and _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + pos))) == 0) {
+			pos += 16;
+			continue;
+		}
+
+		uint8_t size = utf8_valid_size(s + pos, len - pos);
+
+		if (size == 0)
+			return false;
+		pos += size;
+	}
+
+	return true;
+}
+
+__attribute__((target("avx2")))
+__m256i scan_symbol_mask_avx2(__m256i v) {
+	__m256i printable = _mm256_andnot_si256(
+		_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x7e)),
+		_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x20))
+	);
+
+	__m256i folded = _mm256_and_si256(v, _mm256_set1_epi8((char)0xdf));
+	__m256i delim = _mm256_or_si256(
+		_mm256_or_si256(
+			_mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(1)), _mm256_set1_epi8(')')),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))
+		),
+		_mm256_or_si256(
+			_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('[')),
+			_mm256_cmpeq_epi8(folded, _mm256_set1_epi8(']'))
+		)
+	);
+
+	return _mm256_andnot_si256(delim, printable);
+}
+
+__attribute__((target("avx2")))
+__m256i scan_space_mask_avx2(__m256i v) {
+	return _mm256_or_si256(
+		_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+		_mm256_andnot_si256(
+			_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x0d)),
+			_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x08))
+		)
+	);
+}
+
+__attribute__((target("avx2")))
+__m256i scan_structural_mask_avx2(__m256i v) {
+	__m256i folded = _mm256_and_si256(v, _mm256_set1_epi8((char)0xdf));
+	return _mm256_or_si256(
+		_mm256_or_si256(
+			_mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(1)), _mm256_set1_epi8(')')),
+			_mm256_or_si256(
+				_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+				_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))
+			)
+		),
+		_mm256_or_si256(
+			_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('[')),
+			_mm256_cmpeq_epi8(folded, _mm256_set1_epi8(']'))
+		)
+	);
+}
+
+__attribute__((target("avx2")))
+size_t scan_symbol_avx2(const char *s, size_t pos, size_t len) {
+	while (pos + 32 <= len) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + pos));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(scan_symbol_mask_avx2(v));
+
+		if (mask != 0xffffffff)
+			return pos + (size_t)__builtin_ctz(~mask);
+		pos += 32;
+	}
+	return scan_symbol_sse2(s, pos, len);
+}
+
+__attribute__((target("avx2")))
+size_t scan_space_avx2(const char *s, size_t pos, size_t len) {
+	while (pos + 32 <= len) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + pos));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(scan_space_mask_avx2(v));
+
+		if (mask != 0xffffffff)
+			return pos + (size_t)__builtin_ctz(~mask);
+		pos += 32;
+	}
+	return scan_space_sse2(s, pos, len);
+}
+
+__attribute__((target("avx2")))
+size_t scan_structural_avx2(const char *s, size_t pos, size_t len) {
+	while (pos + 32 <= len) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + pos));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(scan_structural_mask_avx2(v));
+
+		if (mask != 0)
+			return pos + (size_t)__builtin_ctz(mask);
+		pos += 32;
+	}
+	return scan_structural_sse2(s, pos, len);
+}
+
+__attribute__((target("avx2")))
+size_t scan_newline_avx2(const char *s, size_t pos, size_t len) {
+	while (pos + 32 <= len) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + pos));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+
+		if (mask != 0)
+			return pos + (size_t)__builtin_ctz(mask);
+		pos += 32;
+	}
+	return scan_newline_sse2(s, pos, len);
+}
+
+// UTF-8 validation with the lookup tables of simdjson (Keiser and Lemire,
+// "Validating UTF-8 In Less Than One Instruction Per Byte"). The high and low
+// nibble of each byte and the high nibble of the byte after it index three
+// tables of the errors that pair could be part of, and the tables agree on
+// an error only where there is one.
+#define SCAN_UTF8_TOO_SHORT  (1 << 0) // Lead not followed by a continuation
+#define SCAN_UTF8_TOO_LONG   (1 << 1) // ASCII followed by a continuation
+#define SCAN_UTF8_OVERLONG_3 (1 << 2) // E0 80..9F
+#define SCAN_UTF8_TOO_LARGE  (1 << 3) // F4 90..BF, F5..FF
+#define SCAN_UTF8_SURROGATE  (1 << 4) // ED A0..BF
+#define SCAN_UTF8_OVERLONG_2 (1 << 5) // C0..C1
+#define SCAN_UTF8_OVERLONG_4 (1 << 6) // F0 80..8F, and F5..FF 80..8F
+#define SCAN_UTF8_TWO_CONTS  (1 << 7) // Two continuations in a row
+#define SCAN_UTF8_CARRY      (SCAN_UTF8_TOO_SHORT | SCAN_UTF8_TOO_LONG | SCAN_UTF8_TWO_CONTS)
+
+// The bytes of v shifted in by n from the end of prev
+#define scan_utf8_prev_avx2(v, prev, n) \
+	_mm256_alignr_epi8((v), _mm256_permute2x128_si256((prev), (v), 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+__m256i scan_utf8_lookup_avx2(__m256i index, __m128i table) {
+	return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(table), index);
+}
+
+// Nonzero bytes where v, following prev, isn't valid UTF-8
+__attribute__((target("avx2")))
+__m256i scan_utf8_errors_avx2(__m256i v, __m256i prev) {
+	__m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i prev1 = scan_utf8_prev_avx2(v, prev, 1);
+
+	__m256i byte_1_high = scan_utf8_lookup_avx2(
+		_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble),
+		_mm_setr_epi8(
+			// 0___: ASCII
+			SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG,
+			SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG,
+			// 10__: continuation
+			(char)SCAN_UTF8_TWO_CONTS, (char)SCAN_UTF8_TWO_CONTS, (char)SCAN_UTF8_TWO_CONTS, (char)SCAN_UTF8_TWO_CONTS,
+			// 1100, 1101: two byte lead
+			SCAN_UTF8_TOO_SHORT | SCAN_UTF8_OVERLONG_2,
+			SCAN_UTF8_TOO_SHORT,
+			// 1110: three byte lead
+			SCAN_UTF8_TOO_SHORT | SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_SURROGATE,
+			// 1111: four byte lead
+			SCAN_UTF8_TOO_SHORT | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4
+		)
+	);
+
+	__m256i byte_1_low = scan_utf8_lookup_avx2(
+		_mm256_and_si256(prev1, nibble),
+		_mm_setr_epi8(
+			// ____0000
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_OVERLONG_4),
+			// ____0001
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_OVERLONG_2),
+			// ____001_
+			(char)(SCAN_UTF8_CARRY),
+			(char)(SCAN_UTF8_CARRY),
+			// ____0100
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE),
+			// ____0101 and up, ____1101 also leads surrogates
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4 | SCAN_UTF8_SURROGATE),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4),
+			(char)(SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_OVERLONG_4)
+		)
+	);
+
+	__m256i byte_2_high = scan_utf8_lookup_avx2(
+		_mm256_and_si256(_mm256_srli_epi16(v, 4), nibble),
+		_mm_setr_epi8(
+			// 0___: ASCII
+			SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT,
+			SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT,
+			// 1000
+			(char)(SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS | SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_OVERLONG_4),
+			// 1001
+			(char)(SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS | SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_TOO_LARGE),
+			// 101_
+			(char)(SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS | SCAN_UTF8_SURROGATE | SCAN_UTF8_TOO_LARGE),
+			(char)(SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS | SCAN_UTF8_SURROGATE | SCAN_UTF8_TOO_LARGE),
+			// 11__: lead
+			SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT
+		)
+	);
+
+	__m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+	// Two continuations in a row are only valid two or three bytes after
+	// the lead of a three or four byte sequence
+	__m256i third = _mm256_subs_epu8(scan_utf8_prev_avx2(v, prev, 2), _mm256_set1_epi8((char)(0xe0 - 0x80)));
+	__m256i fourth = _mm256_subs_epu8(scan_utf8_prev_avx2(v, prev, 3), _mm256_set1_epi8((char)(0xf0 - 0x80)));
+	__m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+	return _mm256_xor_si256(must_continue, special);
+}
+
+__attribute__((target("avx2")))
+bool scan_utf8_avx2(const char *s, size_t len) {
+	__m256i prev = _mm256_setzero_si256();
+	__m256i errors = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+
+	// Leads in the last three bytes of a block that need more bytes than are left
+	__m256i max_complete = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		(char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1)
+	);
+
+	// The last block is padded with at least one NUL, which catches a
+	// sequence cut short by the end of the input
+	for (size_t pos = 0; pos <= len; pos += 32) {
+		__m256i v;
+
+		if (pos + 32 <= len) {
+			v = _mm256_loadu_si256((const __m256i *)(s + pos));
+		} else {
+			char tail[32] = { 0 };
+			memcpy(tail, s + pos, len - pos);
+			v = _mm256_loadu_si256((const __m256i *)tail);
+		}
+
+		if (_mm256_movemask_epi8(v) == 0) {
+			errors = _mm256_or_si256(errors, incomplete);
+			incomplete = _mm256_setzero_si256();
+		} else {
+			errors = _mm256_or_si256(errors, scan_utf8_errors_avx2(v, prev));
+			incomplete = _mm256_subs_epu8(v, max_complete);
+		}
+
+		prev = v;
+	}
+
+	return _mm256_testz_si256(errors, errors);
+}
+
+#endif
+
+typedef size_t (*scan_fn_t)(const char *, size_t, size_t);
+
+typedef struct scan_impl {
+	char *name;
+	scan_fn_t symbol;
+	scan_fn_t space;
+	scan_fn_t structural;
+	scan_fn_t newline;
+	bool (*utf8)(const char *, size_t);
+} scan_impl_t;
+
+scan_impl_t scan_impls[] = {
+	{ "scalar", scan_symbol_scalar, scan_space_scalar, scan_structural_scalar, scan_newline_scalar, scan_utf8_scalar },
+#ifdef SCAN_X86
+	{ "sse2",   scan_symbol_sse2,   scan_space_sse2,   scan_structural_sse2,   scan_newline_sse2,   scan_utf8_sse2 },
+	{ "avx2",   scan_symbol_avx2,   scan_space_avx2,   scan_structural_avx2,   scan_newline_avx2,   scan_utf8_avx2 },
+#endif
+	{ NULL }
+};
+
+// Implementation used by the lexer, picked by scan_init unless set beforehand
+scan_impl_t scan = { 0 };
+
+bool scan_supported(scan_impl_t impl) {
+#ifdef SCAN_X86
+	if (impl.symbol == scan_symbol_avx2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return true;
+}
+
+pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+void scan_select() {
+	if (scan.name != NULL)
+		return;
+
+	for (size_t i = 0; scan_impls[i].name != NULL; i++)
+		if (scan_supported(scan_impls[i]))
+			scan = scan_impls[i];
+}
+
+// Select the widest implementation the CPU supports, safe to call from
+// several lexers at once
+void scan_init() {
+	pthread_once(&scan_once, scan_select);
+}
+
+test_result_t scan_test() {
+	// Every byte value, in runs of random lengths so some cross vector boundaries
+	size_t len = 4096;
+	char *s = malloc(len);
+	uint64_t state = 7;
+
+	for (size_t i = 0; i < len;) {
+		state = state * 6364136223846793005U + 1442695040888963407U;
+		size_t run = (state >> 40) % 48;
+		uint8_t kind = (uint8_t)(state >> 20);
+
+		for (size_t j = 0; j < run and i < len; j++, i++) {
+			state = state * 6364136223846793005U + 1442695040888963407U;
+			uint8_t c = (uint8_t)(state >> 33);
+
+			if (kind % 3 == 0)
+				c = (uint8_t)('a' + c % 26);
+			else if (kind % 3 == 1)
+				c = (uint8_t)" \t\n\r"[c % 4];
+
+			s[i] = (char)c;
+		}
+	}
+
+	for (size_t i = 0; scan_impls[i].name != NULL; i++) {
+		scan_impl_t impl = scan_impls[i];
+
+		if (!scan_supported(impl))
+			continue;
+
+		for (size_t pos = 0; pos < len; pos++) {
+			if (impl.symbol(s, pos, len) != scan_symbol_scalar(s, pos, len))
+				return test_fail("%s symbol scan differs at %zu", impl.name, pos);
+
+			if (impl.space(s, pos, len) != scan_space_scalar(s, pos, len))
+				return test_fail("%s space scan differs at %zu", impl.name, pos);
+
+			if (impl.structural(s, pos, len) != scan_structural_scalar(s, pos, len))
+				return test_fail("%s structural scan differs at %zu", impl.name, pos);
+
+			if (impl.newline(s, pos, len) != scan_newline_scalar(s, pos, len))
+				return test_fail("%s newline scan differs at %zu", impl.name, pos);
+		}
+	}
+
+	free(s);
+	return test_pass();
+}
+
+test_result_t scan_utf8_test() {
+	// Each case is checked at every offset in ASCII padding, so it lands on
+	// both sides of a vector boundary and right at the end of the input
+	struct { char *bytes; bool valid; } cases[] = {
+		{ "a", true },
+		{ "\xc2\xa2", true },
+		{ "\xe2\x82\xac", true },
+		{ "\xf0\x9d\x84\x9e", true },
+		{ "\xef\xbf\xbf", true },
+		{ "\xf4\x8f\xbf\xbf", true },
+		{ "\xed\x9f\xbf", true },
+		{ "\x80", false },
+		{ "\xbf\xbf", false },
+		{ "\xc0\x80", false },
+		{ "\xc1\xbf", false },
+		{ "\xe0\x80\x80", false },
+		{ "\xe0\x9f\xbf", false },
+		{ "\xed\xa0\x80", false },
+		{ "\xf0\x80\x80\x80", false },
+		{ "\xf0\x8f\xbf\xbf", false },
+		{ "\xf4\x90\x80\x80", false },
+		{ "\xf5\x80\x80\x80", false },
+		{ "\xff", false },
+		{ "\xc2", false },
+		{ "\xe2\x82", false },
+		{ "\xf0\x9d\x84", false },
+		{ "\xc2\xa2\xa2", false },
+		{ "\xe2\x82\xac\xac", false },
+	};
+
+	char buf[96];
+
+	for (size_t c = 0; c < sizeof(cases)/sizeof(*cases); c++) {
+		size_t n = strlen(cases[c].bytes);
+
+		for (size_t offset = 0; offset + n <= 70; offset++) {
+			size_t lens[] = { offset + n, 70, 64, 96 };
+
+			memset(buf, 'x', sizeof(buf));
+			memcpy(buf + offset, cases[c].bytes, n);
+
+			for (size_t l = 0; l < sizeof(lens)/sizeof(*lens); l++) {
+				// Skip lengths that cut the case short, those are cases of their own
+				if (lens[l] > offset and lens[l] < offset + n)
+					continue;
+
+				bool expect = cases[c].valid or lens[l] <= offset;
+
+				if (scan_utf8_scalar(buf, lens[l]) != expect)
+					return test_fail("scalar: case %zu at %zu, length %zu", c, offset, lens[l]);
+
+				for (size_t i = 0; scan_impls[i].name != NULL; i++)
+					if (scan_supported(scan_impls[i]) and scan_impls[i].utf8(buf, lens[l]) != expect)
+						return test_fail("%s: case %zu at %zu, length %zu", scan_impls[i].name, c, offset, lens[l]);
+			}
+		}
+	}
+
+	// Random mixes of valid sequences and bytes that are often not
+	size_t len = 4096;
+	char *s = malloc(len);
+	uint64_t state = 11;
+
+	for (size_t round = 0; round < 64; round++) {
+		for (size_t i = 0; i < len; i++) {
+			state = state * 6364136223846793005U + 1442695040888963407U;
+			s[i] = (char)(state >> 33);
+
+			// Mostly valid so errors aren't always in the first block
+			if (round % 2 == 0 and (state >> 60) != 0)
+				s[i] = (char)(s[i] & 0x7f);
+		}
+
+		bool expect = scan_utf8_scalar(s, len);
+
+		for (size_t i = 0; scan_impls[i].name != NULL; i++)
+			if (scan_supported(scan_impls[i]) and scan_impls[i].utf8(s, len) != expect)
+				return test_fail("%s differs on random input %zu", scan_impls[i].name, round);
+	}
+
+	free(s);
+	return test_pass();
+}
+
+// Validation throughput of every implementation, on ASCII and on text
+// that is mostly not
+void scan_utf8_bench() {
+	char *inputs[] = {
+		"(fn main () (println \"hello world\") (return 0))\n",
+		"(\xce\xbb \"h\xc3\xa9llo w\xc3\xb6rld \xe2\x9c\x93 \xf0\x9d\x84\x9e\" \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e)\n",
+	};
+	char *names[] = { "ascii", "mixed" };
+	size_t len = 64 << 20;
+	char *buf = malloc(len);
+
+	for (size_t i = 0; i < sizeof(inputs)/sizeof(*inputs); i++) {
+		size_t n = strlen(inputs[i]);
+
+		for (size_t pos = 0; pos < len; pos += n)
+			memcpy(buf + pos, inputs[i], n < len - pos ? n : len - pos);
+
+		// Don't end on a cut sequence
+		size_t valid = len - len % n;
+
+		for (size_t j = 0; scan_impls[j].name != NULL; j++) {
+			if (!scan_supported(scan_impls[j]))
+				continue;
+
+			uint64_t start = bench_now();
+			bool ok = scan_impls[j].utf8(buf, valid);
+			uint64_t elapsed = bench_now() - start;
+
+			printf(
+				"utf8 %-6s %s: %8.1f MB/s%s\n",
+				scan_impls[j].name, names[i], (double)valid / 1e6 / ((double)elapsed / 1e9), ok ? "" : " (rejected)"
+			);
+		}
+	}
+
+	free(buf);
+}
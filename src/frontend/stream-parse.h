@@ -0,0 +1,119 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#pragma once
+
+// Parsing of input that can't be mapped, like pipes and stdin. The input is
+// read in chunks into a buffer, every run of complete top-level forms in it
+// is parsed and dropped, and only the unfinished form at its end is kept
+// for the next read. Memory stays bounded by the largest top-level form
+// rather than the size of the input.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <iso646.h>
+
+#include <utils/buffer.h>
+#include <utils/arena.h>
+#include <utils/misc.h>
+
+#include <frontend/lexer.h>
+#include <frontend/ast.h>
+#include <frontend/parallel-parse.h>
+
+// Bytes read at a time, and parsed at least at a time
+#define STREAM_CHUNK (1 << 20)
+
+ast_program_t parse_stream(int fd) {
+	size_t cap = 4 * STREAM_CHUNK;
+	size_t len = 0;
+	// One more byte for a NUL after the data
+	char *buf = malloc(cap + 1);
+
+	if (buf == NULL)
+		error(1, "Failed to allocate input buffer");
+
+	form_scan_t forms = { 0 };
+	source_loc_t origin = { 1, 1 };
+	ast_program_t prog = { NULL };
+	bool eof = false;
+
+	while (!eof) {
+		// Only grow when a single form fills most of the buffer
+		if (cap - len < STREAM_CHUNK) {
+			cap *= 2;
+			buf = realloc(buf, cap + 1);
+
+			if (buf == NULL)
+				error(1, "Failed to allocate input buffer");
+		}
+
+		ssize_t n = read(fd, buf + len, cap - len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			int err = errno;
+			error(err, "Failed to read input: %s", strerror(err));
+		}
+
+		eof = n == 0;
+		form_scan(&forms, buf, len, len + (size_t)n);
+		len += (size_t)n;
+		buf[len] = 0;
+
+		// Pipes hand out little at a time, parse in bigger pieces
+		if (!eof and len < STREAM_CHUNK)
+			continue;
+
+		// Everything left is parsed at the end, so unclosed forms get reported
+		size_t cut = eof ? len : forms.complete;
+
+		if (cut == 0)
+			continue;
+
+		source_check_utf8(buf, cut, origin);
+
+		parse_worker_t worker = { buf, 0, cut, origin, { NULL }, { 0 }, { 0 }, NULL };
+		parse_worker(&worker);
+
+		if (worker.error != NULL)
+			error(1, "%s", worker.error);
+
+		arena_merge(&ast_arena, &worker.ast_arena);
+		arena_merge(&type_arena, &worker.type_arena);
+
+		for (size_t i = 0; i < buffer_len(worker.program.items); i++)
+			buffer_push_arena(&ast_arena, prog.items, worker.program.items[i]);
+
+		// Keep the unfinished form, the scan state stays valid for it
+		origin = source_loc_advance(origin, buf, cut);
+		memmove(buf, buf + cut, len - cut);
+		len -= cut;
+
+		buffer_free(forms.starts);
+		forms.complete = 0;
+	}
+
+	free(buf);
+
+	return prog;
+}
@@ -0,0 +1,152 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+
+#include <utils/intern.h>
+
+// Keywords, operators and builtin type names. These are interned first, in
+// this order, so the interned ID of a symbol is its sym_kind_t.
+typedef enum sym_kind {
+	SYM_TRUE,
+	SYM_FALSE,
+
+	SYM_ADD,
+	SYM_SUB,
+	SYM_MUL,
+	SYM_DIV,
+	SYM_MOD,
+
+	SYM_EQ,
+	SYM_NEQ,
+	SYM_LT,
+	SYM_GT,
+	SYM_LTEQ,
+	SYM_GTEQ,
+
+	SYM_AND,
+	SYM_OR,
+	SYM_NOT,
+
+	SYM_ARRAY,
+	SYM_GET,
+	SYM_REF,
+	SYM_AREF,
+	SYM_CAST,
+
+	SYM_DECL,
+	SYM_SET,
+	SYM_LET,
+	SYM_RETURN,
+	SYM_IF,
+	SYM_WHILE,
+	SYM_STORE,
+
+	SYM_INCLUDE,
+	SYM_FUNC,
+	SYM_RECORD,
+	SYM_VARARG,
+
+	SYM_TYPE_ARRAY,
+	SYM_TYPE_POINTER,
+	SYM_TYPE_RECORD,
+
+	SYM_I8,
+	SYM_U8,
+	SYM_I16,
+	SYM_U16,
+	SYM_I32,
+	SYM_U32,
+	SYM_I64,
+	SYM_U64,
+	SYM_F32,
+	SYM_F64,
+	SYM_BOOL,
+	SYM_VOID,
+
+	SYM_COUNT
+} sym_kind_t;
+
+char *sym_str[] = {
+	[SYM_TRUE]  = "true",
+	[SYM_FALSE] = "false",
+
+	[SYM_ADD]   = "+",
+	[SYM_SUB]   = "-",
+	[SYM_MUL]   = "*",
+	[SYM_DIV]   = "/",
+	[SYM_MOD]   = "mod",
+
+	[SYM_EQ]    = "=",
+	[SYM_NEQ]   = "!=",
+	[SYM_LT]    = "<",
+	[SYM_GT]    = ">",
+	[SYM_LTEQ]  = "<=",
+	[SYM_GTEQ]  = ">=",
+
+	[SYM_AND]   = "and",
+	[SYM_OR]    = "or",
+	[SYM_NOT]   = "not",
+
+	[SYM_ARRAY] = "array",
+	[SYM_GET]   = "get",
+	[SYM_REF]   = "ref",
+	[SYM_AREF]  = "aref",
+	[SYM_CAST]  = "cast",
+
+	[SYM_DECL]   = "decl",
+	[SYM_SET]    = "set",
+	[SYM_LET]    = "let",
+	[SYM_RETURN] = "return",
+	[SYM_IF]     = "if",
+	[SYM_WHILE]  = "while",
+	[SYM_STORE]  = "store",
+
+	[SYM_INCLUDE] = "include",
+	[SYM_FUNC]    = "func",
+	[SYM_RECORD]  = "record",
+	[SYM_VARARG]  = "...",
+
+	[SYM_TYPE_ARRAY]   = "Array",
+	[SYM_TYPE_POINTER] = "@",
+	[SYM_TYPE_RECORD]  = "Record",
+
+	[SYM_I8]   = "I8",
+	[SYM_U8]   = "U8",
+	[SYM_I16]  = "I16",
+	[SYM_U16]  = "U16",
+	[SYM_I32]  = "I32",
+	[SYM_U32]  = "U32",
+	[SYM_I64]  = "I64",
+	[SYM_U64]  = "U64",
+	[SYM_F32]  = "F32",
+	[SYM_F64]  = "F64",
+	[SYM_BOOL] = "Bool",
+	[SYM_VOID] = "Void",
+};
+
+// Seed the interner with every keyword so their IDs line up with sym_kind_t
+void symbols_init() {
+	intern_init(sym_str, SYM_COUNT);
+
+	for (size_t i = 0; i < SYM_COUNT; i++)
+		assert(intern_id(intern_str(sym_str[i])) == i);
+}
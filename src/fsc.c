@@ -18,14 +18,19 @@
 
 #include <stdio.h>
 #include <locale.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include <utils/log.h>
 #include <utils/argp.h>
 #include <utils/kv.h>
 
+#include <frontend/symbols.h>
 #include <frontend/lexer.h>
 #include <frontend/parser.h>
 #include <frontend/ast.h>
+#include <frontend/parallel-parse.h>
+#include <frontend/stream-parse.h>
 
 #include <visitors/c-gen.h>
 #include <visitors/type-check.h>
@@ -40,15 +45,21 @@ arg_app_t app = {
 };
 
 arg_def_t args[] = {
-	{ "input",  'i',   "INPUT",  "Specify the input file",            arg_takes_val },
+	{ "input",  'i',   "INPUT",  "Specify the input file, - for stdin", arg_takes_val },
 	{ "output", 'o',   "OUTPUT", "Specify the output file",           arg_takes_val },
 	{ "loglevel", 'l', "LOG",    "Specifiy the verbosity of logging", arg_takes_val },
+	{ "jobs",   'j',   "JOBS",   "Number of threads to parse and check with", arg_takes_val },
 	{ NULL }
 };
 
 int main(int argc, char *argv[]) {
 	log_level_filter = LOG_WARN;
 	setlocale(LC_ALL, "");
+	// Numeric literals are read and written in C syntax whatever the locale
+	setlocale(LC_NUMERIC, "C");
+
+	// Keywords must be interned before anything else
+	symbols_init();
 
 	// Parse command line arguments
 	kv_store_t arg_vals = kv_new();
@@ -62,6 +73,7 @@ int main(int argc, char *argv[]) {
 	char *in_file = kv_get(&arg_vals, "INPUT");
 	char *out_file = kv_get(&arg_vals, "OUTPUT");
 	char *log_level = kv_get(&arg_vals, "LOG");
+	char *jobs_arg = kv_get(&arg_vals, "JOBS");
 
 	if (log_level != NULL) {
 		if (strcmp("trace", log_level) == 0) {
@@ -75,12 +87,40 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	// Tokenize, parse and compile given input 
-	lexer_init_file(in_file);
-	atom_t program = parse();
-	ast_program_t ast = parse_program(program);
-	type_check(ast);
+	// Parse on every core unless told otherwise
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (jobs_arg != NULL) {
+		char *end;
+		jobs = strtol(jobs_arg, &end, 10);
+
+		if (*end != 0 or jobs < 1)
+			error(1, "%s: invalid number of jobs: %s", argv[0], jobs_arg);
+	}
+
+	// Tokenize, parse and compile given input. The AST holds interned copies
+	// of its text, so the input can go after parsing. Stdin is parsed as it
+	// is read, files are mapped whole and parsed on several threads.
+	ast_program_t ast;
+
+	if (in_file != NULL and strcmp(in_file, "-") == 0) {
+		ast = parse_stream(STDIN_FILENO);
+	} else {
+		lexer_t lexer;
+		lexer_init_file(&lexer, in_file);
+		ast = parse_parallel(&lexer, (size_t)MAX(jobs, 1));
+		lexer_close(&lexer);
+	}
+
+	type_check_parallel(ast, (size_t)MAX(jobs, 1));
 	compile(ast, out_file);
+
+	log_info("AST: %zu allocations, %zu bytes", ast_arena.allocs, ast_arena.reserved);
+	log_info("Types: %zu allocations, %zu bytes", type_arena.allocs, type_arena.reserved);
+	log_info("Distinct types: %zu", type_table_count());
+	arena_free(&ast_arena);
+	arena_free(&type_arena);
+	type_table_free();
 	
 	return 0;
 }
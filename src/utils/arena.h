@@ -0,0 +1,131 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+// Region allocator. Allocations are bump allocated from large blocks and are
+// never freed individually, everything in an arena is released at once.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <iso646.h>
+
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t used;
+	size_t cap;
+	_Alignas(max_align_t) char data[];
+} arena_block_t;
+
+typedef struct arena {
+	arena_block_t *blocks;
+	// Statistics, for logging and benchmarks
+	size_t allocs;
+	size_t reserved;
+} arena_t;
+
+// Size of a regular block, larger allocations get a block of their own
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Allocate a new block with room for at least size bytes
+arena_block_t *arena__block(arena_t *arena, size_t size) {
+	arena_block_t *block = malloc(offsetof(arena_block_t, data) + size);
+
+	if (block == NULL) {
+		fprintf(stderr, "Failed to allocate %zu bytes for arena\n", size);
+		exit(1);
+	}
+
+	block->next = NULL;
+	block->used = 0;
+	block->cap = size;
+	arena->reserved += size;
+	return block;
+}
+
+// Allocate size bytes aligned to align (a power of 2, at most max_align_t)
+void *arena_alloc_aligned(arena_t *arena, size_t size, size_t align) {
+	arena_block_t *block = arena->blocks;
+	size_t start = block ? (block->used + align - 1) & ~(align - 1) : 0;
+
+	if (block == NULL or start + size > block->cap) {
+		if (size > ARENA_BLOCK_SIZE / 4) {
+			// Oversized, keep filling the current block afterwards
+			block = arena__block(arena, size);
+
+			if (arena->blocks != NULL) {
+				block->next = arena->blocks->next;
+				arena->blocks->next = block;
+			} else {
+				arena->blocks = block;
+			}
+		} else {
+			block = arena__block(arena, ARENA_BLOCK_SIZE);
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+
+		start = 0;
+	}
+
+	block->used = start + size;
+	arena->allocs++;
+
+	return block->data + start;
+}
+
+// Allocate size bytes, suitably aligned for any type
+void *arena_alloc(arena_t *arena, size_t size) {
+	return arena_alloc_aligned(arena, size, _Alignof(max_align_t));
+}
+
+// Move every allocation of from into arena, leaving from empty. The current
+// block of arena stays the one allocations continue in.
+void arena_merge(arena_t *arena, arena_t *from) {
+	if (from->blocks == NULL)
+		return;
+
+	if (arena->blocks == NULL) {
+		arena->blocks = from->blocks;
+	} else {
+		arena_block_t *last = from->blocks;
+		while (last->next != NULL)
+			last = last->next;
+
+		last->next = arena->blocks->next;
+		arena->blocks->next = from->blocks;
+	}
+
+	arena->allocs += from->allocs;
+	arena->reserved += from->reserved;
+	*from = (arena_t){ NULL, 0, 0 };
+}
+
+// Release everything allocated from an arena
+void arena_free(arena_t *arena) {
+	while (arena->blocks != NULL) {
+		arena_block_t *next = arena->blocks->next;
+		free(arena->blocks);
+		arena->blocks = next;
+	}
+
+	*arena = (arena_t){ NULL, 0, 0 };
+}
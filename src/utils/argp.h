@@ -131,8 +131,9 @@ bool arg_parse(arg_def_t *defs, kv_store_t *store, int argc, char **argv) {
 		any_args = true;
 
 		if (arg.check != NULL) {
-			// Option takes a value. Make sure one was passed, and that it is valid
-			if (++i < argc and argv[i][0] != '-') {
+			// Option takes a value. Make sure one was passed, and that it is valid.
+			// A lone dash is a value, standing for stdin or stdout.
+			if (++i < argc and (argv[i][0] != '-' or argv[i][1] == 0)) {
 				if (arg.check(argv[i])) 
 					kv_insert(store, arg.value_name, argv[i]);
 				else {
@@ -0,0 +1,52 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <utils/log.h>
+
+typedef struct bench_def {
+	char *name;
+	void (*func)();
+} bench_def_t;
+
+// Wall clock time in nanoseconds
+uint64_t bench_now() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+// Execute all benchmarks specified, each one prints its own results
+int bench_run(bench_def_t *benches) {
+	// Iterate until NULL entry encountered
+	size_t i = 0;
+	while (benches[i].name != 0 && benches[i].func != 0) {
+		bench_def_t def = benches[i];
+
+		printf("== %s\n", def.name);
+		def.func();
+		i++;
+	}
+	return 0;
+}
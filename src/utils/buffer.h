@@ -25,7 +25,9 @@
 #include <stddef.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <utils/arena.h>
 #include <utils/log.h>
 
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
@@ -55,6 +57,11 @@ typedef struct buffer_header {
 // Push a value to the buffer like a stack
 #define buffer_push(b, ...) (buffer_fit((b), 1 + buffer_len(b)), (b)[buffer__hdr(b)->len++] = (__VA_ARGS__))
 
+// Variants of buffer_fit and buffer_push for buffers living in an arena. These
+// must never be mixed with the heap variants, or freed with buffer_free.
+#define buffer_fit_arena(a, b, n) ((n) <= buffer_cap(b) ? 0 : ((b) = buffer__grow_arena((a), (b), (n), sizeof(*(b)))))
+#define buffer_push_arena(a, b, ...) (buffer_fit_arena((a), (b), 1 + buffer_len(b)), (b)[buffer__hdr(b)->len++] = (__VA_ARGS__))
+
 // (Re)allocate a buffer to accomodate new_len * elem_size bytes
 void *buffer__grow(const void *buf, size_t new_len, size_t elem_size) {
 	assert(buffer_cap(buf) <= (SIZE_MAX - 1)/2);
@@ -72,3 +79,80 @@ void *buffer__grow(const void *buf, size_t new_len, size_t elem_size) {
 	new_hdr->cap = new_cap;
 	return new_hdr->buf;
 }
+
+// Move a buffer into a larger allocation from an arena, the old storage is
+// left for the arena to release
+void *buffer__grow_arena(arena_t *arena, const void *buf, size_t new_len, size_t elem_size) {
+	size_t new_cap = MAX(4, MAX(2*buffer_cap(buf), new_len));
+	assert(new_cap <= (SIZE_MAX - offsetof(buffer_header_t, buf))/elem_size);
+	buffer_header_t *new_hdr = arena_alloc(arena, offsetof(buffer_header_t, buf) + new_cap*elem_size);
+
+	new_hdr->len = buffer_len(buf);
+	new_hdr->cap = new_cap;
+
+	if (buf)
+		memcpy(new_hdr->buf, buf, buffer_len(buf)*elem_size);
+
+	return new_hdr->buf;
+}
+
+// Small buffers keep their first n items inline and only spill to a heap
+// buffer past that, so short lists can live on the stack or inside a struct:
+//     small_buffer_t(int, 8) buffer_of_integers = { 0 };
+#define small_buffer_t(x, n) struct { size_t len; x *heap; x inline_buf[n]; }
+
+// Inline capacity, length and item pointer of a small buffer
+#define small_buffer_inline_cap(b) (sizeof((b).inline_buf) / sizeof(*(b).inline_buf))
+#define small_buffer_len(b) ((b).len)
+#define small_buffer_items(b) ((b).heap ? (b).heap : (b).inline_buf)
+
+// Push a value, moving the inline items to the heap on the first spill.
+// Once spilled, the items stay on the heap even if popped below the inline capacity.
+#define small_buffer_push(b, ...) do { \
+	if (!(b).heap && (b).len < small_buffer_inline_cap(b)) { \
+		(b).inline_buf[(b).len++] = (__VA_ARGS__); \
+	} else { \
+		if (!(b).heap) { \
+			buffer_fit((b).heap, 2*small_buffer_inline_cap(b)); \
+			memcpy((b).heap, (b).inline_buf, sizeof((b).inline_buf)); \
+			buffer__hdr((b).heap)->len = (b).len; \
+		} \
+		buffer_push((b).heap, __VA_ARGS__); \
+		(b).len++; \
+	} \
+} while (0)
+
+// Remove and return the last item
+#define small_buffer_pop(b) \
+	((b).heap ? (buffer__hdr((b).heap)->len--, (b).heap[--(b).len]) : (b).inline_buf[--(b).len])
+
+// Release the spilled storage (if any) and empty the buffer
+#define small_buffer_free(b) (buffer_free((b).heap), (b).len = 0)
+
+// Copy the items into an exactly sized arena buffer, NULL when empty
+#define small_buffer_to_arena(a, b) buffer__copy_arena((a), small_buffer_items(b), small_buffer_len(b), sizeof(*(b).inline_buf))
+
+// Allocate an exactly sized arena buffer of n items, left uninitialized, or
+// NULL when n is 0
+#define buffer_alloc_arena(a, b, n) ((b) = buffer__alloc_arena((a), (n), sizeof(*(b))))
+
+void *buffer__alloc_arena(arena_t *arena, size_t len, size_t elem_size) {
+	if (len == 0)
+		return NULL;
+
+	assert(len <= (SIZE_MAX - offsetof(buffer_header_t, buf))/elem_size);
+	buffer_header_t *hdr = arena_alloc(arena, offsetof(buffer_header_t, buf) + len*elem_size);
+	hdr->len = len;
+	hdr->cap = len;
+
+	return hdr->buf;
+}
+
+void *buffer__copy_arena(arena_t *arena, const void *items, size_t len, size_t elem_size) {
+	void *buf = buffer__alloc_arena(arena, len, elem_size);
+
+	if (buf != NULL)
+		memcpy(buf, items, len*elem_size);
+
+	return buf;
+}
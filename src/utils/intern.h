@@ -21,76 +21,258 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <iso646.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
+#include <utils/arena.h>
 #include <utils/buffer.h>
+#include <utils/bench.h>
 #include <utils/misc.h>
 #include <utils/test.h>
 #include <utils/log.h>
 
-// An interned string
-typedef struct intern_entry {
+// Stored directly before the bytes of every interned string
+typedef struct intern_header {
 	uint64_t hash;
-	char *string;
-} intern_entry_t;
+	uint32_t id;
+	uint32_t len;
+} intern_header_t;
 
-buffer_t(intern_entry_t) interned = NULL;
+// Open addressing hash table of interned strings, probed linearly. Entries are
+// never removed, so there are no tombstones and growing is a plain rehash.
+// Slots are published atomically so lookups never have to take a lock.
+typedef struct intern_table {
+	size_t cap;
+	struct intern_table *retired;
+	_Atomic(char *) slots[];
+} intern_table_t;
 
-// Look for an interned string by it's hash
-char *intern_find(uint64_t hash) {
-	for (size_t i = 0; i < buffer_len(interned); i++)
-		if (interned[i].hash == hash)
-			return interned[i].string;
+// One shard of the interner. Lookups only read the table, inserting, growing
+// and allocating string storage happen with the shard lock held.
+typedef struct intern_shard {
+	_Atomic(intern_table_t *) table;
+	size_t len;
+	arena_t strings;
+	pthread_mutex_t lock;
+} intern_shard_t;
 
-	return NULL;
+// Initial number of slots per shard, must be a power of 2
+#define INTERN_MIN_CAP 64
+// Maximum percentage of slots in use before a table is grown
+#define INTERN_MAX_LOAD 70
+// Number of shards (as a power of 2), chosen by the top bits of the hash
+#define INTERN_SHARD_BITS 6
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+
+intern_shard_t intern_shards[INTERN_SHARDS];
+_Atomic uint32_t intern_next_id = 0;
+pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+void intern_shards_init() {
+	for (size_t i = 0; i < INTERN_SHARDS; i++)
+		if (pthread_mutex_init(&intern_shards[i].lock, NULL) != 0)
+			error(1, "Failed to initialize interner lock");
 }
 
-// If a string has already been interned, return a pointer to it, else allocate and intern provided string
-char *intern_str(char *str) {
-	uint64_t hash = str_hash(str);
-
-	char *entry = intern_find(hash);
-	
-	if (entry) 
-		return entry;
-	else {
-		char *buf = heap_string(str);
-		intern_entry_t entry = { hash, buf };
-		buffer_push(interned, entry);
-		return buf;
+// Get the header of an interned string
+intern_header_t *intern_header(char *str) {
+	return (intern_header_t *)str - 1;
+}
+
+// Get the shard responsible for a hash
+intern_shard_t *intern_shard(uint64_t hash) {
+	return intern_shards + (hash >> (64 - INTERN_SHARD_BITS));
+}
+
+// Map a hash to its home slot (Fibonacci hashing, so weak low bits don't cluster)
+size_t intern_slot(uint64_t hash, size_t cap) {
+	return (size_t)((hash * 11400714819323198485U) >> 32) & (cap - 1);
+}
+
+// Check if an interned string holds exactly the given bytes
+bool intern_match(char *string, uint64_t hash, char *start, size_t len) {
+	intern_header_t *header = intern_header(string);
+	return header->hash == hash and header->len == len and memcmp(string, start, len) == 0;
+}
+
+// Find the slot holding a string, or the empty slot it would be inserted into.
+// A hash hit alone isn't enough, colliding strings are kept as separate entries.
+_Atomic(char *) *intern_probe(intern_table_t *table, uint64_t hash, char *start, size_t len) {
+	size_t i = intern_slot(hash, table->cap);
+
+	for (;;) {
+		char *string = atomic_load_explicit(table->slots + i, memory_order_acquire);
+
+		if (string == NULL or intern_match(string, hash, start, len))
+			return table->slots + i;
+
+		i = (i + 1) & (table->cap - 1);
 	}
 }
 
-// intern_str, except dealing with 2 points within a string
-char *intern_range(char *start, char *end) {
-	uint64_t hash = str_range_hash(start, end);
+// Copy a string (plus a NUL terminator) into a shard's string arena, after its header
+char *intern_copy(intern_shard_t *shard, uint64_t hash, char *start, size_t len) {
+	intern_header_t *header = arena_alloc_aligned(
+		&shard->strings, sizeof(intern_header_t) + len + 1, _Alignof(intern_header_t)
+	);
 
-	char *entry = intern_find(hash);
+	header->hash = hash;
+	header->id = atomic_fetch_add(&intern_next_id, 1);
+	header->len = (uint32_t)len;
+	char *buf = (char *)(header + 1);
 
-	if (entry)
-		return entry;
-	else {
-		char *buf = heap_string_range(start, end);
-		intern_entry_t entry = { hash, buf };
-		buffer_push(interned, entry);
-		return buf;
+	memcpy(buf, start, len);
+	buf[len] = 0;
+
+	return buf;
+}
+
+// Double the capacity of a shard's table and reinsert every entry. The old
+// table is kept alive until intern_free as readers may still be probing it.
+void intern_grow(intern_shard_t *shard) {
+	intern_table_t *old = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	size_t cap = old ? old->cap * 2 : INTERN_MIN_CAP;
+	intern_table_t *table = calloc(1, offsetof(intern_table_t, slots) + cap * sizeof(char *));
+
+	if (table == NULL)
+		error(1, "Failed to grow interner to %zu entries", cap);
+
+	table->cap = cap;
+	table->retired = old;
+
+	// Every entry is distinct, so only an empty slot has to be found
+	for (size_t i = 0; old != NULL and i < old->cap; i++) {
+		char *string = atomic_load_explicit(old->slots + i, memory_order_relaxed);
+
+		if (string == NULL)
+			continue;
+
+		size_t j = intern_slot(intern_header(string)->hash, cap);
+		while (atomic_load_explicit(table->slots + j, memory_order_relaxed) != NULL)
+			j = (j + 1) & (cap - 1);
+
+		atomic_store_explicit(table->slots + j, string, memory_order_relaxed);
 	}
+
+	atomic_store_explicit(&shard->table, table, memory_order_release);
 }
 
-// Adds a dummy string to the interner to initialize the stretchy buffer
-void intern_init() {
-	char *string = heap_string("Hello, World!");
-	
-	intern_entry_t entry = { str_hash(string), string };
-	buffer_push(interned, entry);
+// Look for an interned string by it's hash and contents, without locking
+char *intern_find(uint64_t hash, char *start, size_t len) {
+	intern_table_t *table = atomic_load_explicit(&intern_shard(hash)->table, memory_order_acquire);
+
+	if (table == NULL)
+		return NULL;
+
+	return atomic_load_explicit(intern_probe(table, hash, start, len), memory_order_acquire);
 }
 
-// Deallocate all interned strings
+// Insert a string into a shard, the shard lock must be held
+char *intern_insert_locked(intern_shard_t *shard, uint64_t hash, char *start, size_t len) {
+	intern_table_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+
+	if (table == NULL or (shard->len + 1) * 100 > table->cap * INTERN_MAX_LOAD) {
+		intern_grow(shard);
+		table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	}
+
+	char *string = intern_copy(shard, hash, start, len);
+
+	// Publish only once the header and bytes are written
+	atomic_store_explicit(intern_probe(table, hash, start, len), string, memory_order_release);
+	shard->len++;
+
+	return string;
+}
+
+// Insert a string that is not yet interned
+char *intern_insert(uint64_t hash, char *start, size_t len) {
+	pthread_once(&intern_once, intern_shards_init);
+
+	intern_shard_t *shard = intern_shard(hash);
+
+	pthread_mutex_lock(&shard->lock);
+	char *string = intern_insert_locked(shard, hash, start, len);
+	pthread_mutex_unlock(&shard->lock);
+
+	return string;
+}
+
+// Intern the slice of a string between start and end. Safe to call from any
+// thread, the first thread to intern a string decides its canonical pointer.
+char *intern_range(char *start, char *end) {
+	size_t len = (size_t)(end - start);
+	uint64_t hash = buffer_hash(start, len);
+
+	// Fast path, already interned
+	char *string = intern_find(hash, start, len);
+
+	if (string)
+		return string;
+
+	pthread_once(&intern_once, intern_shards_init);
+
+	intern_shard_t *shard = intern_shard(hash);
+	pthread_mutex_lock(&shard->lock);
+
+	// Another thread may have interned it since the lookup
+	string = intern_find(hash, start, len);
+
+	if (string == NULL)
+		string = intern_insert_locked(shard, hash, start, len);
+
+	pthread_mutex_unlock(&shard->lock);
+
+	return string;
+}
+
+// If a string has already been interned, return a pointer to it, else allocate and intern provided string
+char *intern_str(char *str) {
+	return intern_range(str, str + strlen(str));
+}
+
+// Get the ID of an interned string. IDs are handed out in the order strings are
+// first interned, starting at 0, so strings passed to intern_init have known IDs.
+uint32_t intern_id(char *str) {
+	return intern_header(str)->id;
+}
+
+// Number of strings interned so far
+size_t intern_count() {
+	return atomic_load(&intern_next_id);
+}
+
+// Intern a list of strings, giving them the IDs 0 to count - 1. Must be
+// called before any other thread starts interning.
+void intern_init(char **seed, size_t count) {
+	assert(intern_count() == 0);
+
+	for (size_t i = 0; i < count; i++)
+		intern_str(seed[i]);
+}
+
+// Deallocate all interned strings. No other thread may be using the interner.
 void intern_free() {
-	for (size_t i = 0; i < buffer_len(interned); i++) {
-		free(interned[i].string);
+	for (size_t i = 0; i < INTERN_SHARDS; i++) {
+		intern_shard_t *shard = intern_shards + i;
+
+		arena_free(&shard->strings);
+
+		intern_table_t *table = atomic_load(&shard->table);
+
+		while (table != NULL) {
+			intern_table_t *retired = table->retired;
+			free(table);
+			table = retired;
+		}
+
+		atomic_store(&shard->table, NULL);
+		shard->len = 0;
 	}
 
-	buffer_free(interned);
+	atomic_store(&intern_next_id, 0);
 }
 
 // Make sure the string interner works as anticipated
@@ -105,6 +287,214 @@ test_result_t intern_test() {
 	if (str1 == str3 or str2 == str3)
 		return test_fail("Interner allocated 2 strings to the same location");
 
+	if (intern_id(str1) != intern_id(str2) or intern_id(str1) == intern_id(str3))
+		return test_fail("Interned strings were given the wrong IDs");
+
 	else 
 		return test_pass();
 }
+
+// Make sure strings with colliding hashes are never merged
+test_result_t intern_collision_test() {
+	char *str = intern_str("collision_a");
+
+	// Force an entry for a different string under the same hash
+	uint64_t hash = str_hash("collision_a");
+	char *other = intern_insert(hash, "collision_b", strlen("collision_b"));
+
+	if (other == str)
+		return test_fail("Colliding strings were given the same entry");
+
+	if (intern_find(hash, "collision_b", strlen("collision_b")) != other)
+		return test_fail("Colliding string could not be found");
+
+	if (intern_str("collision_a") != str)
+		return test_fail("Original string changed after a collision");
+
+	return test_pass();
+}
+
+// Make sure strings larger than an arena block are stored intact
+test_result_t intern_large_test() {
+	size_t len = ARENA_BLOCK_SIZE * 2;
+	char *big = malloc(len + 1);
+
+	memset(big, 'x', len);
+	big[len] = 0;
+
+	char *small = intern_str("before_large");
+	char *str = intern_str(big);
+
+	bool intact = strcmp(str, big) == 0 and intern_str(big) == str;
+	free(big);
+
+	if (!intact)
+		return test_fail("Large interned string was not stored intact");
+
+	// The current block should still be used for small strings
+	char *next = intern_str("after_large");
+
+	if (strcmp(small, "before_large") != 0 or strcmp(next, "after_large") != 0)
+		return test_fail("Small strings were corrupted around a large string");
+
+	return test_pass();
+}
+
+// Shared between the threads of intern_mt_test and intern_mt_bench
+typedef struct intern_worker {
+	char **names;
+	char **results;
+	size_t count;
+	size_t offset;
+	size_t rounds;
+} intern_worker_t;
+
+// Intern every name, starting at a different offset on each thread
+void *intern_worker(void *arg) {
+	intern_worker_t *worker = arg;
+
+	for (size_t r = 0; r < worker->rounds; r++) {
+		for (size_t i = 0; i < worker->count; i++) {
+			size_t j = (i + worker->offset) % worker->count;
+			worker->results[j] = intern_str(worker->names[j]);
+		}
+	}
+
+	return NULL;
+}
+
+// Generate count distinct names
+char **intern_names(size_t count) {
+	char **names = malloc(count * sizeof(char *));
+	char name[32];
+
+	for (size_t i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "symbol_%zu", i);
+		names[i] = heap_string(name);
+	}
+
+	return names;
+}
+
+// Run threads interning the same names, each one's results are stored in results[t * count...]
+void intern_run_workers(char **names, char **results, size_t count, size_t threads, size_t rounds) {
+	pthread_t ids[threads];
+	intern_worker_t workers[threads];
+
+	for (size_t t = 0; t < threads; t++) {
+		workers[t] = (intern_worker_t){ names, results + t * count, count, t * count / threads, rounds };
+
+		if (pthread_create(ids + t, NULL, intern_worker, workers + t) != 0)
+			error(1, "Failed to start interner thread");
+	}
+
+	for (size_t t = 0; t < threads; t++)
+		pthread_join(ids[t], NULL);
+}
+
+// Hammer the interner from several threads at once, every thread must see the same pointers
+test_result_t intern_mt_test() {
+	size_t count = 20000;
+	size_t threads = 8;
+
+	char **names = intern_names(count);
+	char **results = malloc(count * threads * sizeof(char *));
+	size_t before = intern_count();
+
+	intern_run_workers(names, results, count, threads, 2);
+
+	for (size_t i = 0; i < count; i++) {
+		for (size_t t = 0; t < threads; t++) {
+			if (results[t * count + i] != results[i])
+				return test_fail("Threads got different pointers for '%s'", names[i]);
+		}
+
+		if (strcmp(results[i], names[i]) != 0)
+			return test_fail("Interned '%s' as '%s'", names[i], results[i]);
+
+		if (intern_str(names[i]) != results[i])
+			return test_fail("Interned pointer for '%s' changed", names[i]);
+	}
+
+	// Every string was interned exactly once
+	if (intern_count() - before > count)
+		return test_fail("Interned %zu strings, expected at most %zu", intern_count() - before, count);
+
+	for (size_t i = 0; i < count; i++)
+		free(names[i]);
+
+	free(names);
+	free(results);
+
+	return test_pass();
+}
+
+// Intern N distinct symbols into an empty table, then look all of them up again
+void intern_bench_n(size_t n) {
+	char **names = intern_names(n);
+
+	intern_free();
+
+	uint64_t start = bench_now();
+	for (size_t i = 0; i < n; i++)
+		intern_str(names[i]);
+	uint64_t insert = bench_now() - start;
+
+	start = bench_now();
+	for (size_t i = 0; i < n; i++)
+		intern_str(names[i]);
+	uint64_t lookup = bench_now() - start;
+
+	assert(intern_count() == n);
+
+	printf(
+		"intern %8zu symbols: insert %6.1f ns/op, lookup %6.1f ns/op\n",
+		n, (double)insert / (double)n, (double)lookup / (double)n
+	);
+
+	for (size_t i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+
+	intern_free();
+}
+
+// Per-symbol intern cost should stay flat as the number of unique symbols grows
+void intern_bench() {
+	for (size_t n = 1000; n <= 1000000; n *= 10)
+		intern_bench_n(n);
+}
+
+// Throughput of interning the same set of symbols from 1 to N threads, first
+// with most interning being inserts, then once everything is interned
+void intern_mt_bench() {
+	size_t count = 200000;
+	char **names = intern_names(count);
+	char **results = malloc(count * 16 * sizeof(char *));
+
+	for (size_t threads = 1; threads <= 16; threads *= 2) {
+		intern_free();
+
+		uint64_t start = bench_now();
+		intern_run_workers(names, results, count, threads, 1);
+		uint64_t cold = bench_now() - start;
+
+		start = bench_now();
+		intern_run_workers(names, results, count, threads, 4);
+		uint64_t warm = bench_now() - start;
+
+		printf(
+			"intern %2zu threads: cold %7.2f Mops/s, warm %7.2f Mops/s\n",
+			threads,
+			(double)(count * threads) * 1e3 / (double)cold,
+			(double)(count * threads * 4) * 1e3 / (double)warm
+		);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		free(names[i]);
+
+	free(names);
+	free(results);
+	intern_free();
+}
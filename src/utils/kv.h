@@ -25,48 +25,35 @@
 
 #include <utils/intern.h>
 #include <utils/log.h>
-#include <utils/buffer.h>
+#include <utils/map.h>
 #include <utils/test.h>
 
-typedef struct kv_value {
-	uint64_t hash;
-	char *value;
-} kv_value_t;
+map_define(kv_map, char *, char *, str_hash, str_eq)
 
 // A hashmap of string -> string
 typedef struct kv_store {
-	buffer_t(kv_value_t) values;
+	kv_map_t values;
 } kv_store_t;
 
 kv_store_t kv_new() {
-	return (kv_store_t){ NULL };
+	return (kv_store_t){ { NULL, 0, 0 } };
 }
 
-// Insert a string with a key
+// Insert a string with a key, if the key is already present the first value is kept
 void kv_insert(kv_store_t *store, char *key, char *value) {
-	uint64_t hash = str_hash(key);
-
-	buffer_push(store->values, (kv_value_t){ hash, intern_str(value) });
+	if (kv_map_getp(&store->values, key) == NULL)
+		kv_map_insert(&store->values, intern_str(key), intern_str(value));
 }
 
 // Get a string with a key
 char *kv_get(kv_store_t *store, char *key) {
-	char *value = NULL;
-	uint64_t hash = str_hash(key);
-
-	for (size_t i = 0; i < buffer_len(store->values); i++) {
-		if (store->values[i].hash == hash) {
-			value = store->values[i].value;
-			break;
-		}
-	}
-
-	return value;
+	char **value = kv_map_getp(&store->values, key);
+	return value ? *value : NULL;
 }
 
 // Make sure the kv store is working as intended
 test_result_t kv_test() {
-	kv_store_t store = { NULL };
+	kv_store_t store = kv_new();
 
 	kv_insert(&store, "Hello", "World!");
 
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include <utils/ansi-fmt.h>
 #include <utils/buffer.h>
@@ -47,10 +48,15 @@ const char *log_level_name[] = {
 // Minimum level of importance that will be logged 
 loglevel_t log_level_filter = LOG_INFO;
 
+// Keeps messages from several threads apart, and guards localtime
+pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Log a message with a given level, filename, line and message
 void log_inner(loglevel_t level, const char *filename, uint32_t line, const char *func, char *fmt, ...) {
 	// Only log if the importance is above the minimum level
 	if (level >= log_level_filter) {
+		pthread_mutex_lock(&log_lock);
+
 		time_t rawtime;
 		struct tm *ti;
 
@@ -75,12 +81,20 @@ void log_inner(loglevel_t level, const char *filename, uint32_t line, const char
 		fprintf(stderr, "\n");
 
 		va_end(args);
+
+		pthread_mutex_unlock(&log_lock);
 	}
 }
 
+// Whether messages of a level are logged
+#define log_enabled(level) ((level) >= log_level_filter)
+
+// Log a message if its level is enabled, its arguments aren't evaluated otherwise
+#define log_at(level, ...) (log_enabled(level) ? log_inner((level), __FILE__, __LINE__, __func__, "\n               ⤷ " __VA_ARGS__) : (void)0)
+
 // Log various levels with file and position of caller attached
-#define log_trace(...) log_inner(LOG_TRACE, __FILE__, __LINE__, __func__, "\n               ⤷ " __VA_ARGS__)
-#define log_debug(...) log_inner(LOG_DEBUG, __FILE__, __LINE__, __func__, "\n               ⤷ " __VA_ARGS__)
-#define log_info(...)  log_inner(LOG_INFO,  __FILE__, __LINE__, __func__, "\n               ⤷ " __VA_ARGS__)
-#define log_warn(...)  log_inner(LOG_WARN,  __FILE__, __LINE__, __func__, "\n               ⤷ " __VA_ARGS__)
-#define log_error(...) log_inner(LOG_ERROR, __FILE__, __LINE__, __func__, "\n               ⤷ " __VA_ARGS__)
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
@@ -0,0 +1,313 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+// Open addressing hash maps with linear probing, specialized for a key and
+// value type by a macro (in the spirit of the stretchy buffers), e.g.:
+//     map_define(int_map, char *, int, str_hash, str_eq)
+// defines int_map_t, along with int_map_insert, int_map_getp, int_map_remove,
+// int_map_next, int_map_clone and int_map_free. A zeroed map is empty.
+// Removal shifts later entries back, so there are never any tombstones.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iso646.h>
+
+#include <utils/misc.h>
+#include <utils/buffer.h>
+#include <utils/test.h>
+#include <utils/bench.h>
+
+// Initial number of slots, must be a power of 2
+#define MAP_MIN_CAP 8
+// Maximum percentage of slots in use before the map is grown
+#define MAP_MAX_LOAD 70
+
+// Map a hash to its home slot (Fibonacci hashing, so weak low bits don't cluster)
+size_t map__slot(uint64_t hash, size_t cap) {
+	return (size_t)((hash * 11400714819323198485U) >> 32) & (cap - 1);
+}
+
+#define map_define(name, key_type, val_type, hash_fn, eq_fn) \
+	typedef struct name##_entry { \
+		uint64_t hash; \
+		key_type key; \
+		val_type val; \
+		bool used; \
+	} name##_entry_t; \
+	\
+	typedef struct name { \
+		name##_entry_t *entries; \
+		size_t len; \
+		size_t cap; \
+	} name##_t; \
+	\
+	name##_entry_t *name##__probe(name##_entry_t *entries, size_t cap, uint64_t hash, key_type key) { \
+		size_t i = map__slot(hash, cap); \
+		while (entries[i].used and !(entries[i].hash == hash and eq_fn(entries[i].key, key))) \
+			i = (i + 1) & (cap - 1); \
+		return entries + i; \
+	} \
+	\
+	void name##__grow(name##_t *map) { \
+		size_t cap = map->cap ? map->cap * 2 : MAP_MIN_CAP; \
+		name##_entry_t *entries = calloc(cap, sizeof(name##_entry_t)); \
+		\
+		if (entries == NULL) \
+			error(1, "Failed to grow " #name " to %zu entries", cap); \
+		\
+		for (size_t i = 0; i < map->cap; i++) { \
+			if (!map->entries[i].used) \
+				continue; \
+			\
+			size_t j = map__slot(map->entries[i].hash, cap); \
+			while (entries[j].used) \
+				j = (j + 1) & (cap - 1); \
+			\
+			entries[j] = map->entries[i]; \
+		} \
+		\
+		free(map->entries); \
+		map->entries = entries; \
+		map->cap = cap; \
+	} \
+	\
+	val_type *name##_getp(name##_t *map, key_type key) { \
+		if (map->len == 0) \
+			return NULL; \
+		\
+		name##_entry_t *entry = name##__probe(map->entries, map->cap, hash_fn(key), key); \
+		return entry->used ? &entry->val : NULL; \
+	} \
+	\
+	val_type *name##_insert(name##_t *map, key_type key, val_type val) { \
+		if ((map->len + 1) * 100 > map->cap * MAP_MAX_LOAD) \
+			name##__grow(map); \
+		\
+		uint64_t hash = hash_fn(key); \
+		name##_entry_t *entry = name##__probe(map->entries, map->cap, hash, key); \
+		\
+		if (!entry->used) { \
+			entry->used = true; \
+			entry->hash = hash; \
+			entry->key = key; \
+			map->len++; \
+		} \
+		\
+		entry->val = val; \
+		return &entry->val; \
+	} \
+	\
+	bool name##_remove(name##_t *map, key_type key) { \
+		if (map->len == 0) \
+			return false; \
+		\
+		size_t mask = map->cap - 1; \
+		name##_entry_t *entry = name##__probe(map->entries, map->cap, hash_fn(key), key); \
+		\
+		if (!entry->used) \
+			return false; \
+		\
+		size_t i = (size_t)(entry - map->entries); \
+		size_t j = i; \
+		\
+		for (;;) { \
+			j = (j + 1) & mask; \
+			\
+			if (!map->entries[j].used) \
+				break; \
+			\
+			size_t home = map__slot(map->entries[j].hash, map->cap); \
+			\
+			if (((j - home) & mask) >= ((j - i) & mask)) { \
+				map->entries[i] = map->entries[j]; \
+				i = j; \
+			} \
+		} \
+		\
+		map->entries[i].used = false; \
+		map->len--; \
+		return true; \
+	} \
+	\
+	name##_entry_t *name##_next(name##_t *map, size_t *i) { \
+		while (*i < map->cap) { \
+			name##_entry_t *entry = map->entries + (*i)++; \
+			\
+			if (entry->used) \
+				return entry; \
+		} \
+		\
+		return NULL; \
+	} \
+	\
+	name##_t name##_clone(name##_t *map) { \
+		name##_t new = *map; \
+		\
+		if (map->cap != 0) { \
+			new.entries = malloc(map->cap * sizeof(name##_entry_t)); \
+			memcpy(new.entries, map->entries, map->cap * sizeof(name##_entry_t)); \
+		} \
+		\
+		return new; \
+	} \
+	\
+	void name##_free(name##_t *map) { \
+		free(map->entries); \
+		*map = (name##_t){ NULL, 0, 0 }; \
+	}
+
+// Hash an integer key
+uint64_t map_int_hash(uint64_t key) {
+	return hash_mix(key ^ HASH_SECRET0, HASH_SECRET1);
+}
+
+bool map_int_eq(uint64_t a, uint64_t b) {
+	return a == b;
+}
+
+// Hash a pointer key by its address
+uint64_t map_ptr_hash(void *key) {
+	return map_int_hash((uint64_t)(uintptr_t)key);
+}
+
+bool map_ptr_eq(void *a, void *b) {
+	return a == b;
+}
+
+map_define(int_map, uint64_t, uint64_t, map_int_hash, map_int_eq)
+
+// Compare the map against a plain array through random inserts and removals
+test_result_t map_test() {
+	size_t count = 512;
+	uint64_t *expect = calloc(count, sizeof(uint64_t));
+	int_map_t map = { 0 };
+	uint64_t state = 1;
+
+	for (size_t i = 0; i < 20000; i++) {
+		state = state * 6364136223846793005U + 1442695040888963407U;
+		uint64_t key = (state >> 33) % count;
+
+		if ((state >> 20) % 3 == 0) {
+			bool removed = int_map_remove(&map, key);
+
+			if (removed != (expect[key] != 0))
+				return test_fail("Removing key %lu returned %d", (unsigned long)key, removed);
+
+			expect[key] = 0;
+		} else {
+			int_map_insert(&map, key, i + 1);
+			expect[key] = i + 1;
+		}
+	}
+
+	size_t len = 0;
+	for (uint64_t key = 0; key < count; key++) {
+		uint64_t *val = int_map_getp(&map, key);
+
+		if (expect[key] == 0 and val != NULL)
+			return test_fail("Removed key %lu still present", (unsigned long)key);
+
+		if (expect[key] != 0 and (val == NULL or *val != expect[key]))
+			return test_fail("Key %lu has the wrong value", (unsigned long)key);
+
+		len += expect[key] != 0;
+	}
+
+	size_t seen = 0;
+	size_t i = 0;
+	while (int_map_next(&map, &i) != NULL)
+		seen++;
+
+	if (seen != len or map.len != len)
+		return test_fail("Iterated %zu entries, expected %zu", seen, len);
+
+	int_map_free(&map);
+	free(expect);
+
+	return test_pass();
+}
+
+// Entry of the linear tables the maps replaced, kept for comparison
+typedef struct map_linear_entry {
+	uint64_t hash;
+	char *key;
+	uint64_t val;
+} map_linear_entry_t;
+
+map_define(str_bench_map, char *, uint64_t, str_hash, str_eq)
+
+// Lookups in a map against a linear scan over a buffer, the way symbol,
+// function, record and typedef tables used to be searched
+void map_bench() {
+	char name[32];
+
+	for (size_t n = 10; n <= 100000; n *= 100) {
+		char **keys = malloc(n * sizeof(char *));
+		buffer_t(map_linear_entry_t) linear = NULL;
+		str_bench_map_t map = { 0 };
+
+		for (size_t i = 0; i < n; i++) {
+			snprintf(name, sizeof(name), "symbol_%zu", i);
+			keys[i] = heap_string(name);
+
+			buffer_push(linear, (map_linear_entry_t){ str_hash(keys[i]), keys[i], i });
+			str_bench_map_insert(&map, keys[i], i);
+		}
+
+		// Keep the linear scan from taking forever on large tables
+		size_t lookups = n < 10000 ? 100000 : 2000;
+		uint64_t sink = 0;
+
+		uint64_t start = bench_now();
+		for (size_t l = 0; l < lookups; l++) {
+			char *key = keys[(l * 7919) % n];
+			uint64_t hash = str_hash(key);
+
+			for (size_t i = 0; i < buffer_len(linear); i++) {
+				if (linear[i].hash == hash and str_eq(linear[i].key, key)) {
+					sink += linear[i].val;
+					break;
+				}
+			}
+		}
+		uint64_t scan = bench_now() - start;
+
+		start = bench_now();
+		for (size_t l = 0; l < lookups; l++)
+			sink += *str_bench_map_getp(&map, keys[(l * 7919) % n]);
+		uint64_t hashed = bench_now() - start;
+
+		printf(
+			"map %6zu entries: linear scan %10.1f ns/op, map %6.1f ns/op (%lu)\n",
+			n, (double)scan / (double)lookups, (double)hashed / (double)lookups, (unsigned long)(sink & 1)
+		);
+
+		for (size_t i = 0; i < n; i++)
+			free(keys[i]);
+
+		free(keys);
+		buffer_free(linear);
+		str_bench_map_free(&map);
+	}
+}
@@ -23,8 +23,13 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <setjmp.h>
+#include <string.h>
+#include <stdbool.h>
+#include <iso646.h>
 
 #include <utils/test.h>
+#include <utils/bench.h>
 #include <utils/log.h>
 
 void error(int, char*, ...);
@@ -63,31 +68,95 @@ char *heap_string_range(char *start, char *end) {
 	return buf;
 }
 
-// Get the FNV-1 hash of a buffer
+// Constants used by buffer_hash (from wyhash)
+#define HASH_SECRET0 0xa0761d6478bd642fU
+#define HASH_SECRET1 0xe7037ed1a0b428dbU
+#define HASH_SECRET2 0x8ebc6af09c88c6e3U
+#define HASH_SECRET3 0x589965cc75374cc3U
+
+// Unaligned native-endian loads
+uint64_t hash_read64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t hash_read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// Multiply two 64 bit words into 128 bits and fold the halves together
+uint64_t hash_mix(uint64_t a, uint64_t b) {
+	__extension__ unsigned __int128 r = (unsigned __int128)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// Hash a buffer a word at a time, in the style of wyhash. Inputs over 16 bytes
+// are consumed in 32 byte blocks across 2 independent lanes, then 16 byte
+// blocks, with the last 16 bytes read overlapping the previous block.
 uint64_t buffer_hash(char *buf, size_t len) {
-	uint64_t hash = 14695981039346656037U;
+	const uint8_t *p = (const uint8_t *)buf;
+	uint64_t seed = HASH_SECRET0 ^ hash_mix(HASH_SECRET0, HASH_SECRET1);
+	uint64_t a, b;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			size_t off = (len >> 3) << 2;
+			a = (hash_read32(p) << 32) | hash_read32(p + off);
+			b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - off);
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+
+		if (i > 32) {
+			uint64_t seed1 = seed;
+
+			do {
+				seed  = hash_mix(hash_read64(p)      ^ HASH_SECRET1, hash_read64(p + 8)  ^ seed);
+				seed1 = hash_mix(hash_read64(p + 16) ^ HASH_SECRET2, hash_read64(p + 24) ^ seed1);
+				p += 32;
+				i -= 32;
+			} while (i > 32);
+
+			seed ^= seed1;
+		}
+
+		while (i > 16) {
+			seed = hash_mix(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
 
-	char c;
-	for (size_t i = 0; i < len; i++) {
-		c = buf[i];
-		hash *= 1099511628211;
-		hash ^= (uint64_t)c;
+		a = hash_read64(p + i - 16);
+		b = hash_read64(p + i - 8);
 	}
 
-	return hash;
+	return hash_mix(HASH_SECRET3 ^ len, hash_mix(a ^ HASH_SECRET1, b ^ seed));
 }
 
-// Get the FNV-1 hash of a string
+// Get the hash of a string
 uint64_t str_hash(char *str) {
 	return buffer_hash(str, strlen(str));
 }
 
-// Get the FNV-1 hash of a slice of a string
+// Get the hash of a slice of a string
 uint64_t str_range_hash(char *start, char *end) {
 	size_t length = (size_t)(end - start);
 	return buffer_hash(start, length);
 }
 
+// Check if two strings are equal, short circuiting for interned strings
+bool str_eq(char *a, char *b) {
+	return a == b or strcmp(a, b) == 0;
+}
+
 test_result_t misc_test() {
 	char vals[] = {1, 2, 3, 4};
 	char not_vals[] = {5, 6, 7, 8};
@@ -101,20 +170,110 @@ test_result_t misc_test() {
 	if (str_hash(string) != str_range_hash(string2, string2 + strlen(string)))
 		return test_fail("Buffer hashes should be equal");
 
+	// Exercise the block loops, strings differing only in their last byte
+	char *long1 = "a_rather_long_identifier_that_spans_several_blocks_1";
+	char *long2 = "a_rather_long_identifier_that_spans_several_blocks_2";
+
+	if (str_hash(long1) == str_hash(long2))
+		return test_fail("Long string hashes are equal when they should not be");
+
+	char zeros[8] = { 0 };
+
+	if (buffer_hash(zeros, 3) == buffer_hash(zeros, 4))
+		return test_fail("Hashes of different lengths are equal");
+
+	return test_pass();
+}
+
+test_result_t small_buffer_test() {
+	small_buffer_t(int, 4) small = { 0 };
+
+	for (int i = 0; i < 4; i++)
+		small_buffer_push(small, i);
+
+	if (small.heap != NULL)
+		return test_fail("Small buffer spilled before its inline capacity was reached");
+
+	for (int i = 4; i < 100; i++)
+		small_buffer_push(small, i);
+
+	if (small.heap == NULL or small_buffer_len(small) != 100)
+		return test_fail("Small buffer did not spill correctly");
+
+	for (int i = 0; i < 100; i++)
+		if (small_buffer_items(small)[i] != i)
+			return test_fail("Small buffer item %d is %d", i, small_buffer_items(small)[i]);
+
+	// Pushing again after popping below the inline capacity, like a stack
+	for (int i = 0; i < 98; i++)
+		small_buffer_pop(small);
+
+	small_buffer_push(small, 2);
+
+	for (int i = 2; i >= 0; i--)
+		if (small_buffer_pop(small) != i)
+			return test_fail("Small buffer popped the wrong item after a spill");
+
+	for (int i = 0; i < 100; i++)
+		small_buffer_push(small, i);
+
+	arena_t arena = { 0 };
+	buffer_t(int) copy = small_buffer_to_arena(&arena, small);
+	small_buffer_free(small);
+
+	if (buffer_len(copy) != 100 or buffer_cap(copy) != 100 or copy[99] != 99)
+		return test_fail("Arena copy of a small buffer is wrong");
+
+	arena_free(&arena);
 	return test_pass();
 }
 
+// Hashing throughput over identifier-sized and longer keys
+void hash_bench() {
+	char buf[256];
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = (char)('a' + i % 26);
+
+	for (size_t len = 8; len <= sizeof(buf); len *= 2) {
+		size_t iters = (size_t)(1 << 26) / len;
+		uint64_t sink = 0;
+
+		uint64_t start = bench_now();
+		for (size_t i = 0; i < iters; i++) {
+			buf[0] = (char)i;
+			sink ^= buffer_hash(buf, len);
+		}
+		uint64_t time = bench_now() - start;
+
+		printf(
+			"hash %3zu byte keys: %6.2f ns/op, %7.1f MB/s (%lx)\n",
+			len, (double)time / (double)iters, (double)(iters * len) * 1e3 / (double)time, (unsigned long)(sink & 0xf)
+		);
+	}
+}
+
 // Heap allocate a formatted string based on a varargs list
 char *vheap_fmt(char *fmt, va_list args) {
-	int size = vsnprintf(NULL, 0, fmt, args) + 1;
+	// Most strings fit a small first guess and are only formatted once.
+	// Formatting consumes the list, so keep a copy for when they don't.
+	va_list retry;
+	va_copy(retry, args);
+
+	size_t cap = 64;
+	char *buf = malloc(cap);
+	int size = vsnprintf(buf, cap, fmt, args);
 
 	if (size < 0) {
 		int err = errno;
 		error(err, "Failed to format string '%s': %s", fmt, strerror(err));
 	}
-	
-	char *buf = malloc((size_t)size);
-	vsprintf(buf, fmt, args);
+
+	if ((size_t)size >= cap) {
+		buf = realloc(buf, (size_t)size + 1);
+		vsnprintf(buf, (size_t)size + 1, fmt, retry);
+	}
+
+	va_end(retry);
 	return buf;
 }
 
@@ -129,14 +288,27 @@ char *heap_fmt(char *fmt, ...) {
 	return buf;
 }
 
+// When set, error() jumps here with the exit code instead of exiting, and
+// leaves its message in error_message. Work done on other threads traps its
+// errors so they can be reported in a deterministic order afterwards.
+_Thread_local jmp_buf *error_trap = NULL;
+_Thread_local char *error_message = NULL;
+
 // Print an error message and exit with code
 void error(int code, char *fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
 
-	log_error("%s", vheap_fmt(fmt, args));
+	char *msg = vheap_fmt(fmt, args);
 
 	va_end(args);
+
+	if (error_trap != NULL) {
+		error_message = msg;
+		longjmp(*error_trap, code != 0 ? code : 1);
+	}
+
+	log_error("%s", msg);
 	exit(code);
 }
 
@@ -0,0 +1,302 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#pragma once
+
+// Parsing of numeric literals: decimal integers eight digits at a time,
+// hex and binary integers, and decimal floats. Floats take an exact fast
+// path when both the digits and the power of ten fit a double, and strtod
+// (with LC_NUMERIC left as "C") otherwise, so results are always correctly
+// rounded.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iso646.h>
+
+#include <utils/test.h>
+
+typedef struct number {
+	enum {
+		NUMBER_INT,
+		NUMBER_FLOAT,
+		NUMBER_ERROR
+	} kind;
+
+	union {
+		int64_t int_val;
+		double float_val;
+		char *error;
+	};
+
+	// Offset just past the literal
+	size_t end;
+} number_t;
+
+bool number_is_digit(char c) {
+	return c >= '0' and c <= '9';
+}
+
+// Whether the 8 bytes in v are all ASCII digits
+bool number_is_8_digits(uint64_t v) {
+	return (((v & 0xf0f0f0f0f0f0f0f0U) | (((v + 0x0606060606060606U) & 0xf0f0f0f0f0f0f0f0U) >> 4)) == 0x3333333333333333U);
+}
+
+// Value of 8 ASCII digits loaded little endian, first digit in the lowest
+// byte. Pairs, then quads, then the whole are combined with multiplies.
+uint32_t number_parse_8_digits(uint64_t v) {
+	v -= 0x3030303030303030U;
+	v = (v * 10) + (v >> 8);
+	v = (((v & 0x000000ff000000ffU) * 0x000f424000000064U) + (((v >> 16) & 0x000000ff000000ffU) * 0x0000271000000001U)) >> 32;
+	return (uint32_t)v;
+}
+
+// Append the run of decimal digits at s[*pos..len) to m, setting truncated
+// if some didn't fit in 19 digits. Returns the number of digits read.
+size_t number_digits(const char *s, size_t *pos, size_t len, uint64_t *m, bool *truncated) {
+	size_t start = *pos;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// Whole groups of 8 while the result stays below 10^19
+	while (*pos + 8 <= len and *m < 100000000000U) {
+		uint64_t v;
+		memcpy(&v, s + *pos, sizeof(v));
+
+		if (!number_is_8_digits(v))
+			break;
+
+		*m = *m * 100000000U + number_parse_8_digits(v);
+		*pos += 8;
+	}
+#endif
+
+	for (; *pos < len and number_is_digit(s[*pos]); (*pos)++) {
+		if (*m < 1000000000000000000U)
+			*m = *m * 10 + (uint64_t)(s[*pos] - '0');
+		else
+			*truncated = true;
+	}
+
+	return *pos - start;
+}
+
+// Integer literal in base 16 or 2 after its prefix
+number_t number_parse_base(const char *s, size_t pos, size_t len, unsigned shift) {
+	number_t num = { .kind = NUMBER_INT };
+	uint64_t m = 0;
+	size_t start = pos;
+
+	for (; pos < len; pos++) {
+		char c = s[pos];
+		uint64_t digit;
+
+		if (c >= '0' and c <= '9')
+			digit = (uint64_t)(c - '0');
+		else if (c >= 'a' and c <= 'f')
+			digit = (uint64_t)(c - 'a' + 10);
+		else if (c >= 'A' and c <= 'F')
+			digit = (uint64_t)(c - 'A' + 10);
+		else
+			break;
+
+		if (digit >> shift != 0)
+			break;
+
+		if (m > (uint64_t)INT64_MAX >> shift)
+			return (number_t){ .kind = NUMBER_ERROR, .error = "Integer literal out of range", .end = pos };
+
+		m = m << shift | digit;
+	}
+
+	if (pos == start)
+		return (number_t){ .kind = NUMBER_ERROR, .error = "Expected digits after base prefix", .end = pos };
+
+	num.int_val = (int64_t)m;
+	num.end = pos;
+	return num;
+}
+
+// Powers of ten that are exact doubles
+const double number_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parse the literal starting with a digit at s[pos]
+number_t number_parse(const char *s, size_t pos, size_t len) {
+	size_t start = pos;
+
+	if (s[pos] == '0' and pos + 1 < len) {
+		if (s[pos + 1] == 'x' or s[pos + 1] == 'X')
+			return number_parse_base(s, pos + 2, len, 4);
+		if (s[pos + 1] == 'b' or s[pos + 1] == 'B')
+			return number_parse_base(s, pos + 2, len, 1);
+	}
+
+	uint64_t m = 0;
+	bool truncated = false;
+
+	number_digits(s, &pos, len, &m, &truncated);
+
+	bool is_float = false;
+	int64_t exp = 0;
+
+	// A fraction needs digits after the point
+	if (pos + 1 < len and s[pos] == '.' and number_is_digit(s[pos + 1])) {
+		pos++;
+		is_float = true;
+		exp -= (int64_t)number_digits(s, &pos, len, &m, &truncated);
+	}
+
+	// So does an exponent after its sign
+	if (pos + 1 < len and (s[pos] == 'e' or s[pos] == 'E')) {
+		size_t digits = pos + 1;
+		bool negative = false;
+
+		if (s[digits] == '-' or s[digits] == '+') {
+			negative = s[digits] == '-';
+			digits++;
+		}
+
+		if (digits < len and number_is_digit(s[digits])) {
+			int64_t e = 0;
+
+			for (pos = digits; pos < len and number_is_digit(s[pos]); pos++)
+				if (e < 100000)
+					e = e * 10 + (s[pos] - '0');
+
+			exp += negative ? -e : e;
+			is_float = true;
+		}
+	}
+
+	if (!is_float) {
+		if (truncated or m > INT64_MAX)
+			return (number_t){ .kind = NUMBER_ERROR, .error = "Integer literal out of range", .end = pos };
+
+		return (number_t){ .kind = NUMBER_INT, .int_val = (int64_t)m, .end = pos };
+	}
+
+	number_t num = { .kind = NUMBER_FLOAT, .end = pos };
+
+	// Both the digits and the power of ten are exact, so is their product
+	// or quotient (Clinger's fast path)
+	if (!truncated and m <= (1ULL << 53) and exp >= -22 and exp <= 22) {
+		double d = (double)m;
+		num.float_val = exp < 0 ? d / number_pow10[-exp] : d * number_pow10[exp];
+		return num;
+	}
+
+	// The literal isn't NUL terminated in the input
+	char small[64];
+	size_t n = pos - start;
+	char *copy = n < sizeof(small) ? small : malloc(n + 1);
+
+	memcpy(copy, s + start, n);
+	copy[n] = 0;
+	num.float_val = strtod(copy, NULL);
+
+	if (copy != small)
+		free(copy);
+
+	if (isinf(num.float_val))
+		return (number_t){ .kind = NUMBER_ERROR, .error = "Float literal out of range", .end = pos };
+
+	return num;
+}
+
+test_result_t number_test() {
+	struct { char *text; int kind; int64_t int_val; double float_val; size_t end; } cases[] = {
+		{ "0",                    NUMBER_INT,   0,                   0, 1 },
+		{ "7)",                   NUMBER_INT,   7,                   0, 1 },
+		{ "12345678",             NUMBER_INT,   12345678,            0, 8 },
+		{ "1234567890123",        NUMBER_INT,   1234567890123,       0, 13 },
+		{ "9223372036854775807",  NUMBER_INT,   INT64_MAX,           0, 19 },
+		{ "0012345678901234567",  NUMBER_INT,   12345678901234567,   0, 19 },
+		{ "0x7fffffffFFFFFFFF",   NUMBER_INT,   INT64_MAX,           0, 18 },
+		{ "0xff ",                NUMBER_INT,   255,                 0, 4 },
+		{ "0b1011",               NUMBER_INT,   11,                  0, 6 },
+		{ "0b12",                 NUMBER_INT,   1,                   0, 3 },
+		{ "12abc",                NUMBER_INT,   12,                  0, 2 },
+		{ "1.",                   NUMBER_INT,   1,                   0, 1 },
+		{ "1e",                   NUMBER_INT,   1,                   0, 1 },
+		{ "1.5",                  NUMBER_FLOAT, 0,                   1.5, 3 },
+		{ "0.1",                  NUMBER_FLOAT, 0,                   0.1, 3 },
+		{ "3.14159265358979",     NUMBER_FLOAT, 0,                   3.14159265358979, 16 },
+		{ "1e10",                 NUMBER_FLOAT, 0,                   1e10, 4 },
+		{ "2.5E-3)",              NUMBER_FLOAT, 0,                   2.5e-3, 6 },
+		{ "1e+300",               NUMBER_FLOAT, 0,                   1e300, 6 },
+		{ "4.9e-324",             NUMBER_FLOAT, 0,                   4.9e-324, 8 },
+		{ "1e-400",               NUMBER_FLOAT, 0,                   0, 6 },
+		{ "9007199254740993.0",   NUMBER_FLOAT, 0,                   9007199254740993.0, 18 },
+		{ "123456789012345678901234567890.5", NUMBER_FLOAT, 0,       123456789012345678901234567890.5, 32 },
+		{ "9223372036854775808",  NUMBER_ERROR, 0,                   0, 19 },
+		{ "99999999999999999999", NUMBER_ERROR, 0,                   0, 20 },
+		{ "0x8000000000000000",   NUMBER_ERROR, 0,                   0, 17 },
+		{ "0x",                   NUMBER_ERROR, 0,                   0, 2 },
+		{ "1e999",                NUMBER_ERROR, 0,                   0, 5 },
+	};
+
+	for (size_t i = 0; i < sizeof(cases)/sizeof(*cases); i++) {
+		number_t num = number_parse(cases[i].text, 0, strlen(cases[i].text));
+
+		if ((int)num.kind != cases[i].kind or num.end != cases[i].end)
+			return test_fail("'%s': kind %d ending at %zu", cases[i].text, num.kind, num.end);
+
+		if (num.kind == NUMBER_INT and num.int_val != cases[i].int_val)
+			return test_fail("'%s': parsed %ld", cases[i].text, num.int_val);
+
+		if (num.kind == NUMBER_FLOAT and num.float_val != cases[i].float_val)
+			return test_fail("'%s': parsed %.17g", cases[i].text, num.float_val);
+	}
+
+	// Random decimals through both float paths, which must round like strtod
+	uint64_t state = 3;
+	char text[64];
+
+	for (size_t i = 0; i < 100000; i++) {
+		state = state * 6364136223846793005U + 1442695040888963407U;
+		unsigned digits = 1 + (unsigned)(state >> 59) % 20;
+		unsigned point = (unsigned)(state >> 40) % digits;
+		int exp = (int)((state >> 20) % 80) - 40;
+		size_t n = 0;
+
+		for (unsigned d = 0; d < digits; d++) {
+			state = state * 6364136223846793005U + 1442695040888963407U;
+			text[n++] = (char)('0' + (state >> 33) % 10);
+
+			if (d == point)
+				text[n++] = '.';
+		}
+
+		if (text[n - 1] == '.')
+			text[n++] = '0';
+
+		n += (size_t)sprintf(text + n, "e%d", exp);
+
+		number_t num = number_parse(text, 0, n);
+		double expect = strtod(text, NULL);
+
+		if (num.kind != NUMBER_FLOAT or num.end != n or memcmp(&num.float_val, &expect, sizeof(expect)) != 0)
+			return test_fail("'%s': parsed %.17g, expected %.17g", text, num.float_val, expect);
+	}
+
+	return test_pass();
+}
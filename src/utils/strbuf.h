@@ -0,0 +1,134 @@
+/*
+ *  This file is part of Falsetto.
+ *
+ *  Falsetto is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Falsetto is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Falsetto.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#pragma once
+
+// Growable strings built by appending. Formatting writes straight into the
+// spare capacity, and only formats again when there wasn't enough of it.
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <iso646.h>
+
+#include <utils/misc.h>
+#include <utils/buffer.h>
+#include <utils/arena.h>
+#include <utils/test.h>
+
+// The characters are always followed by a 0, which isn't counted in the length
+typedef struct strbuf {
+	buffer_t(char) chars;
+} strbuf_t;
+
+size_t strbuf_len(strbuf_t *sb) {
+	return buffer_len(sb->chars);
+}
+
+// Contents of the builder, valid until it's next changed
+char *strbuf_str(strbuf_t *sb) {
+	return sb->chars ? sb->chars : "";
+}
+
+void strbuf_push(strbuf_t *sb, char *str) {
+	size_t len = buffer_len(sb->chars);
+	size_t add = strlen(str);
+
+	buffer_fit(sb->chars, len + add + 1);
+	memcpy(sb->chars + len, str, add + 1);
+	buffer__hdr(sb->chars)->len = len + add;
+}
+
+void strbuf_vfmt(strbuf_t *sb, char *fmt, va_list args) {
+	size_t len = buffer_len(sb->chars);
+	buffer_fit(sb->chars, len + 1);
+
+	// Formatting consumes the list, keep a copy in case it has to be redone
+	va_list retry;
+	va_copy(retry, args);
+
+	size_t spare = buffer_cap(sb->chars) - len;
+	int size = vsnprintf(sb->chars + len, spare, fmt, args);
+
+	if (size < 0)
+		error(1, "Failed to format string '%s'", fmt);
+
+	if ((size_t)size >= spare) {
+		buffer_fit(sb->chars, len + (size_t)size + 1);
+		vsnprintf(sb->chars + len, (size_t)size + 1, fmt, retry);
+	}
+
+	va_end(retry);
+	buffer__hdr(sb->chars)->len = len + (size_t)size;
+}
+
+void strbuf_fmt(strbuf_t *sb, char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	strbuf_vfmt(sb, fmt, args);
+	va_end(args);
+}
+
+// Copy the contents into an exactly sized arena allocation
+char *strbuf_copy_arena(arena_t *arena, strbuf_t *sb) {
+	size_t len = strbuf_len(sb);
+	char *str = arena_alloc(arena, len + 1);
+
+	memcpy(str, strbuf_str(sb), len + 1);
+	return str;
+}
+
+// Empty the builder, keeping its storage
+void strbuf_clear(strbuf_t *sb) {
+	if (sb->chars) {
+		buffer__hdr(sb->chars)->len = 0;
+		sb->chars[0] = 0;
+	}
+}
+
+void strbuf_free(strbuf_t *sb) {
+	buffer_free(sb->chars);
+}
+
+test_result_t strbuf_test() {
+	strbuf_t sb = { 0 };
+
+	if (strcmp(strbuf_str(&sb), "") != 0)
+		return test_fail("Empty builder isn't an empty string");
+
+	strbuf_push(&sb, "(@ ");
+	strbuf_fmt(&sb, "(Array %s %zu)", "I64", (size_t)12);
+	strbuf_push(&sb, ")");
+
+	if (strcmp(strbuf_str(&sb), "(@ (Array I64 12))") != 0 or strbuf_len(&sb) != 18)
+		return test_fail("Expected '(@ (Array I64 12))', found '%s'", strbuf_str(&sb));
+
+	// Longer than any spare capacity, so it has to be formatted twice
+	char long_str[1000];
+	memset(long_str, 'x', sizeof(long_str) - 1);
+	long_str[sizeof(long_str) - 1] = 0;
+
+	strbuf_clear(&sb);
+	strbuf_fmt(&sb, "<%s>", long_str);
+
+	if (strbuf_len(&sb) != 1001 or sb.chars[0] != '<' or sb.chars[1000] != '>' or sb.chars[1001] != 0)
+		return test_fail("Long format gave %zu characters", strbuf_len(&sb));
+
+	strbuf_free(&sb);
+	return test_pass();
+}
@@ -55,6 +55,75 @@ wint_t utf8_to_int(char* c) {
 	return 0;
 }
 
+// Size of the well-formed UTF-8 sequence at the start of s[0..len), or 0
+// for one that is malformed, overlong, a surrogate, past U+10FFFF or cut short
+uint8_t utf8_valid_size(const char *s, size_t len) {
+	const uint8_t *u = (const uint8_t *)s;
+	uint8_t lo = 0x80;
+	uint8_t hi = 0xbf;
+	uint8_t size;
+
+	if (u[0] < 0x80) {
+		return 1;
+	} else if (u[0] >= 0xc2 and u[0] <= 0xdf) {
+		size = 2;
+	} else if (u[0] >= 0xe0 and u[0] <= 0xef) {
+		size = 3;
+		lo = u[0] == 0xe0 ? 0xa0 : lo;
+		hi = u[0] == 0xed ? 0x9f : hi;
+	} else if (u[0] >= 0xf0 and u[0] <= 0xf4) {
+		size = 4;
+		lo = u[0] == 0xf0 ? 0x90 : lo;
+		hi = u[0] == 0xf4 ? 0x8f : hi;
+	} else {
+		return 0;
+	}
+
+	if (len < size or u[1] < lo or u[1] > hi)
+		return 0;
+
+	for (uint8_t i = 2; i < size; i++)
+		if ((u[i] & 0xc0) != 0x80)
+			return 0;
+
+	return size;
+}
+
+// Offset of the first malformed sequence in s[0..len), len if there is none
+size_t utf8_validate(const char *s, size_t len) {
+	size_t pos = 0;
+
+	while (pos < len) {
+		uint8_t size = utf8_valid_size(s + pos, len - pos);
+
+		if (size == 0)
+			return pos;
+		pos += size;
+	}
+
+	return len;
+}
+
+// Extract a codepoint and its size from input known to be valid UTF-8
+wint_t utf8_decode_valid(const char *s, uint8_t *size) {
+	uint32_t c = (uint8_t)s[0];
+
+	if (c < 0x80) {
+		*size = 1;
+		return c;
+	}
+
+	// The leading ones of a lead byte count the bytes of its sequence
+	uint8_t n = (uint8_t)__builtin_clz(~c << 24);
+	uint32_t out = c & (0x7fu >> n);
+
+	for (uint8_t i = 1; i < n; i++)
+		out = (out << 6) | ((uint8_t)s[i] & 0x3fu);
+
+	*size = n;
+	return out;
+}
+
 // Check if a codepoint is whitespace
 bool utf8_is_whitespace(wint_t c) {
 	return iswspace(c)
@@ -52,6 +52,24 @@ char *unops[] = {
 
 void compile_expr(FILE*, ast_expr_t);
 
+// Write the shortest of 15 to 17 significant digits that reads back as the
+// same double, keeping it a floating literal in C
+void compile_float(FILE *outp, double val) {
+	char buf[32];
+
+	for (int precision = 15; precision <= 17; precision++) {
+		snprintf(buf, sizeof(buf), "%.*g", precision, val);
+
+		if (strtod(buf, NULL) == val)
+			break;
+	}
+
+	if (strpbrk(buf, ".e") == NULL)
+		strcat(buf, ".0");
+
+	fputs(buf, outp);
+}
+
 void compile_call(FILE *outp, ast_call_t call) {
 	log_trace("Compiling function call: name = '%s', argc = %d", call.name, buffer_len(call.args));
 	
@@ -76,7 +94,7 @@ void compile_expr(FILE *outp, ast_expr_t expr) {
 			fprintf(outp, "%ld", expr.int_val);
 			break;
 		case AST_EXPR_FLOAT:
-			fprintf(outp, "%f", expr.float_val);
+			compile_float(outp, expr.float_val);
 			break;
 		case AST_EXPR_STRING:
 			fprintf(outp, "\"%s\"", expr.string_val);
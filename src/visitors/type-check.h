@@ -20,87 +20,93 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include <utils/intern.h>
 #include <utils/log.h>
 #include <utils/misc.h>
 #include <utils/buffer.h>
+#include <utils/arena.h>
+#include <utils/map.h>
+#include <utils/bench.h>
+#include <utils/test.h>
 
 #include <frontend/ast.h>
 
-buffer_t(uint64_t) def_hashes = NULL;
-buffer_t(char *) defs = NULL;
+map_define(def_set, type_t *, bool, map_ptr_hash, map_ptr_eq)
+map_define(record_map, char *, record_t, str_hash, str_eq)
+map_define(scope_map, char *, size_t, map_ptr_hash, map_ptr_eq)
 
-typedef struct record_entry {
-	uint64_t hash;
-	record_t record;
-} record_entry_t;
+// Canonical types with definitions in defs
+def_set_t def_hashes = { 0 };
+buffer_t(char *) defs = NULL;
 
-buffer_t(record_entry_t) records;
+record_map_t records = { 0 };
 
 void record_def(record_t record) {
-	uint64_t hash = str_hash(record.name);
-
-	for (size_t i = 0; i < buffer_len(records); i++) {
-		if (records[i].hash == hash)
-			error(1, "Record %s already defined");
-	}
+	if (record_map_getp(&records, record.name) != NULL)
+		error(1, "Record %s already defined", record.name);
 
-	record_entry_t entry;
-	entry.hash = hash;
-	entry.record = record;
-
-	buffer_push(records, entry);
+	record_map_insert(&records, record.name, record);
 }
 
-typedef struct item_type_info {
-	uint64_t hash;
+// Variables in scope. Every body pushes a scope on entry and pops it on
+// exit, which forgets the variables added since. Names can't be redeclared
+// while they're visible, so a name is never bound twice and lookups go
+// through one map from (interned) name to binding.
+typedef struct scope_binding {
+	char *name;
 	type_t type;
-} item_type_info_t;
-
-typedef buffer_t(item_type_info_t) type_list_t;
+} scope_binding_t;
 
-void types_add(type_list_t *list, char *name, type_t type) {
-	buffer_t(item_type_info_t) n = *list;
-	
-	uint64_t hash = str_hash(name);
-	buffer_push(n, (item_type_info_t){ hash, type });
+typedef struct scope {
+	scope_map_t names;
+	buffer_t(scope_binding_t) bindings;
+	// Number of bindings when each open scope was pushed
+	buffer_t(size_t) marks;
+} scope_t;
 
-	*list = n;
+void scope_push(scope_t *scope) {
+	buffer_push(scope->marks, buffer_len(scope->bindings));
 }
 
-type_t types_get(type_list_t list, char *name) {
-	log_trace("Get type of %s", name);
+void scope_pop(scope_t *scope) {
+	size_t mark = scope->marks[--buffer__hdr(scope->marks)->len];
 
-	type_t t;
-	t.kind = TYPE_VOID;
-
-	uint64_t hash = str_hash(name);
-	
-	for (size_t i = 0; i < buffer_len(list); i++) {
-		item_type_info_t info = list[i];
+	while (buffer_len(scope->bindings) > mark)
+		scope_map_remove(&scope->names, scope->bindings[--buffer__hdr(scope->bindings)->len].name);
+}
 
-		if (info.hash == hash) {
-			t = info.type;
-			break;
-		}
+// Add a variable, an existing variable with the same name takes precedence
+void scope_add(scope_t *scope, char *name, type_t type) {
+	if (scope_map_getp(&scope->names, name) == NULL) {
+		scope_map_insert(&scope->names, name, buffer_len(scope->bindings));
+		buffer_push(scope->bindings, ((scope_binding_t){ name, type }));
 	}
+}
 
-	return t;
+// Type of a variable, which stays valid until the next variable is added.
+// NULL if there's no such variable.
+type_t *scope_getp(scope_t *scope, char *name) {
+	size_t *index = scope_map_getp(&scope->names, name);
+	return index ? &scope->bindings[*index].type : NULL;
 }
 
-item_type_info_t *types_getp(type_list_t list, char *name) {
-	uint64_t hash = str_hash(name);
-	
-	for (size_t i = 0; i < buffer_len(list); i++) {
-		item_type_info_t info = list[i];
+// Type of a variable, Void if there's no such variable
+type_t scope_get(scope_t *scope, char *name) {
+	log_trace("Get type of %s", name);
 
-		if (info.hash == hash) {
-			return list + i;;
-		}
-	}
+	type_t *found = scope_getp(scope, name);
+	return found ? *found : type_kind(TYPE_VOID);
+}
 
-	return NULL;
+void scope_free(scope_t *scope) {
+	scope_map_free(&scope->names);
+	buffer_free(scope->bindings);
+	buffer_free(scope->marks);
 }
 
 bool type_casts(type_t to, type_t from) {
@@ -117,116 +123,216 @@ bool type_casts(type_t to, type_t from) {
 		case TYPE_I64:
 		case TYPE_U64:
 		case TYPE_INTEGER:
-			return is_integer(from);
+		case TYPE_F32:
+		case TYPE_F64:
+		case TYPE_FLOAT:
+			return is_numeric(from);
 
 		default:
 			return false;
 	}
 }
 
-bool type_coerces(type_t to, type_t from, type_list_t *list, char *symbol_name) {
-	bool coerces;
-	
-	switch (to.kind) {
-		case TYPE_I8:
-		case TYPE_U8:
-		case TYPE_I16:
-		case TYPE_U16:
-		case TYPE_I32:
-		case TYPE_U32:
-		case TYPE_I64:
-		case TYPE_U64:
-		case TYPE_INTEGER:
-			coerces = from.kind == TYPE_INTEGER or from.kind == to.kind; 
-			break;
+// Types are inferred by unification. Integer and float literals get type
+// variables, which are unified with the types they meet, and types built
+// from them mention the variables. Variables are kept in a union-find forest
+// with path compression, the root of each class holding what's known of its
+// type: {Integer} or {Float} while it could still be any type a literal of
+// that kind fits, then the type it was unified with. A function's variables
+// live until all of it is checked, so uses in nested bodies resolve the
+// variables of the bodies around them.
+typedef struct infer_var {
+	size_t parent;
+	size_t rank;
+	type_t type;
+} infer_var_t;
+
+typedef struct infer_let {
+	char *name;
+	type_t *type;
+} infer_let_t;
+
+typedef struct infer {
+	buffer_t(infer_var_t) vars;
+	// Types of expressions mentioning variables, resolved once the function
+	// is checked
+	buffer_t(type_t *) slots;
+	// Let statements among those, which have to be resolved fully
+	buffer_t(infer_let_t) lets;
+} infer_t;
+
+_Thread_local infer_t infer = { 0 };
+
+// A new variable, for a literal of kind TYPE_INTEGER or TYPE_FLOAT
+type_t infer_var(type_kind_t kind) {
+	type_t var = type_kind(TYPE_VAR);
+	var.count = (uint32_t)buffer_len(infer.vars);
+	buffer_push(infer.vars, ((infer_var_t){ var.count, 0, type_kind(kind) }));
+	return var;
+}
 
-		case TYPE_ARRAY:
-			if (from.kind == TYPE_ARRAY and to.count == from.count)
-				coerces = type_coerces(*to.child, *from.child, list, symbol_name);
-			else 
-				coerces = false;
-			break;
+// Root of the class of a variable, pointing the ones on the way straight at it
+size_t infer_find(size_t var) {
+	size_t root = var;
 
-		case TYPE_POINTER:
-			if (from.kind == TYPE_POINTER)
-				coerces = type_coerces(*to.child, *from.child, list, symbol_name);
-			else
-				coerces = false;
-			break;
+	while (infer.vars[root].parent != root)
+		root = infer.vars[root].parent;
 
-		default:
-			coerces = to.kind == from.kind;
-			break;
+	while (infer.vars[var].parent != root) {
+		size_t next = infer.vars[var].parent;
+		infer.vars[var].parent = root;
+		var = next;
 	}
 
-	if (coerces && symbol_name != NULL) {
-		assert(list != NULL);
-		item_type_info_t *i = types_getp(*list, symbol_name);
+	return root;
+}
+
+bool infer_has_vars(type_t type) {
+	while (type.kind == TYPE_POINTER or type.kind == TYPE_ARRAY)
+		type = *type.child;
+
+	return type.kind == TYPE_VAR;
+}
+
+// The type a variable was unified with, or the root of its class if it's
+// still unknown
+type_t infer_prune(type_t type) {
+	if (type.kind != TYPE_VAR)
+		return type;
 
-		if (i == NULL)
-			error(1, "Variable %s not found");
+	size_t root = infer_find(type.count);
 
-		i->type = to;
+	if (is_partial(infer.vars[root].type)) {
+		type_t var = type_kind(TYPE_VAR);
+		var.count = (uint32_t)root;
+		return var;
 	}
 
-	return coerces;
+	return infer.vars[root].type;
 }
 
-type_list_t types_cat(type_list_t first, type_list_t second) {
-	type_list_t new = NULL;
+// Outermost part of a type as known so far, {Integer} or {Float} for unknowns
+type_t infer_view(type_t type) {
+	type = infer_prune(type);
+	return type.kind == TYPE_VAR ? infer.vars[type.count].type : type;
+}
+
+// A type with its variables replaced by what's known of them
+type_t infer_resolve(type_t type) {
+	switch (type.kind) {
+		case TYPE_VAR:
+			type = infer_view(type);
+			return is_partial(type) ? type : infer_resolve(type);
 
-	for (size_t i = 0; i < buffer_len(first); i++) 
-		buffer_push(new, first[i]);
+		case TYPE_POINTER:
+			return infer_has_vars(type) ? type_ptr(infer_resolve(*type.child)) : type;
 
-	for (size_t i = 0; i < buffer_len(second); i++)
-		buffer_push(new, second[i]);
+		case TYPE_ARRAY:
+			return infer_has_vars(type) ? type_array(infer_resolve(*type.child), type.count) : type;
+
+		default:
+			return type;
+	}
+}
 
-	return new;
+char *infer_str(type_t type) {
+	return type_as_string(infer_resolve(type));
 }
-type_list_t types_clone(type_list_t list) {
-	type_list_t new = NULL;
 
-	for (size_t i = 0; i < buffer_len(list); i++) 
-		buffer_push(new, list[i]);
+// Make two types the same, false if they can't be
+bool infer_unify(type_t a, type_t b) {
+	a = infer_prune(a);
+	b = infer_prune(b);
+
+	if (a.kind == TYPE_VAR and b.kind == TYPE_VAR) {
+		if (a.count == b.count)
+			return true;
+
+		// The shallower class goes under the deeper one
+		if (infer.vars[a.count].rank < infer.vars[b.count].rank) {
+			type_t t = a;
+			a = b;
+			b = t;
+		}
+
+		infer_var_t *x = &infer.vars[a.count];
+		infer_var_t *y = &infer.vars[b.count];
+
+		y->parent = a.count;
+
+		if (x->rank == y->rank)
+			x->rank++;
 
-	return new;
+		// A class with a float literal can only be a float
+		if (y->type.kind == TYPE_FLOAT)
+			x->type = y->type;
+
+		return true;
+	}
+
+	if (b.kind == TYPE_VAR) {
+		type_t t = a;
+		a = b;
+		b = t;
+	}
+
+	// Integer literals are exact as floats up to 2^53, like in C
+	if (a.kind == TYPE_VAR) {
+		infer_var_t *x = &infer.vars[a.count];
+		bool fits = x->type.kind == TYPE_FLOAT ? is_float(b) : is_numeric(b);
+
+		if (fits)
+			x->type = b;
+
+		return fits;
+	}
+
+	if (a.kind != b.kind)
+		return false;
+
+	// Equal children are the same canonical type
+	switch (a.kind) {
+		case TYPE_ARRAY:
+			if (a.count != b.count)
+				return false;
+			// fallthrough
+		case TYPE_POINTER:
+			return a.child == b.child or infer_unify(*a.child, *b.child);
+		case TYPE_RECORD:
+			return a.record == b.record;
+		default:
+			return true;
+	}
 }
 
 typedef struct func_type_info {
-	uint64_t hash;
 	type_t ret;
 	buffer_t(type_t) args;
 	bool vararg;
 } func_type_info_t;
 
-buffer_t(func_type_info_t) func_defs = NULL;
+map_define(func_map, char *, func_type_info_t, str_hash, str_eq)
+
+func_map_t func_defs = { 0 };
 
 void add_func_def(ast_func_t func) {
 	func_type_info_t f;
 
-	f.hash = str_hash(func.name);
 	f.args = NULL;
 	f.ret = func.ret;
 	f.vararg = func.vararg;
 
 	for (size_t i = 0; i < buffer_len(func.args); i++)
-		buffer_push(f.args, func.args[i].type);
+		buffer_push_arena(&type_arena, f.args, func.args[i].type);
 
-	buffer_push(func_defs, f);
+	// The first definition of a function takes precedence
+	if (func_map_getp(&func_defs, func.name) == NULL)
+		func_map_insert(&func_defs, func.name, f);
 }
 
-func_type_info_t get_func_def(char *name) {
-	func_type_info_t f = { 0 };
-	uint64_t hash = str_hash(name);
-
-	for (size_t i = 0; i < buffer_len(func_defs); i++) {
-		if (func_defs[i].hash == hash) { 
-			f = func_defs[i];
-			break;
-		}
-	}
-
-	return f;
+// Get the signature of a function, NULL if it isn't defined
+func_type_info_t *get_func_def(char *name) {
+	return func_map_getp(&func_defs, name);
 }
 
 char *array_template = 
@@ -239,37 +345,48 @@ char *array_template =
 char *array_gen(type_t type) {
 	char *ctype = type_to_str(*type.child);
 	char *mangle = type_mangle(type);
-	return heap_fmt(array_template, ctype, type.count, mangle, ctype, mangle, mangle);
+	return heap_fmt(array_template, ctype, (long)type.count, mangle, ctype, mangle, mangle);
 }
 
+// Array types needing a definition, queued by the thread that found them in
+// order of use. Functions are checked on several threads, so the queues are
+// only turned into definitions afterwards, in source order, which keeps the
+// output the same however the work was split.
+_Thread_local buffer_t(type_t *) def_queue = NULL;
+
 void def_type(type_t type) {
-	if (type.kind == TYPE_ARRAY and !is_partial(*type.child)) {
-		
-		char *mangled = type_mangle(type);
-		uint64_t hash = str_hash(mangled);
-		bool found = false;
-
-		for (size_t i = 0; i < buffer_len(def_hashes); i++) 
-			if (def_hashes[i] == hash)
-				found = true;
-
-		if (!found) {
-			def_type(*type.child);
-			char *gen = array_gen(type);
-			buffer_push(defs, gen);
-			buffer_push(def_hashes, str_hash(mangled));
-		}
+	if (type.kind == TYPE_ARRAY and !is_partial(*type.child))
+		buffer_push(def_queue, type_intern(type));
+}
+
+// Define a canonical array type, and before it its element type, unless it
+// already is
+void def_emit(type_t *type) {
+	if (def_set_getp(&def_hashes, type) == NULL) {
+		if (type->child->kind == TYPE_ARRAY and !is_partial(*type->child->child))
+			def_emit(type->child);
+
+		buffer_push(defs, array_gen(*type));
+		def_set_insert(&def_hashes, type, true);
 	}
 }
 
-type_t type_of_expr(type_list_t *types, ast_expr_t expr);
+// Define everything queued on this thread so far
+void def_flush(buffer_t(type_t *) queue) {
+	for (size_t i = 0; i < buffer_len(queue); i++)
+		def_emit(queue[i]);
+}
+
+type_t type_of_expr(scope_t *types, ast_expr_t expr);
 
-type_t type_of_call(type_list_t *types, ast_call_t call) {
-	func_type_info_t info = get_func_def(call.name);
+type_t type_of_call(scope_t *types, ast_call_t call) {
+	func_type_info_t *def = get_func_def(call.name);
 
-	if (info.hash == 0)
+	if (def == NULL)
 		error(1, "Unknown function %s", call.name);
 
+	func_type_info_t info = *def;
+
 	size_t argc = buffer_len(info.args);
 	size_t argp = buffer_len(call.args);
 
@@ -279,18 +396,14 @@ type_t type_of_call(type_list_t *types, ast_call_t call) {
 	for (size_t i = 0; i < argp; i++) {
 		type_t type = type_of_expr(types, call.args[i]);
 
-		char *symb = NULL;
-		if (call.args[i].kind == AST_EXPR_SYMBOL)
-			symb = call.args[i].symbol_val;
-
-		if (!type_coerces(info.args[i], type, types, symb) && i < argc) {
+		if (i < argc && !infer_unify(info.args[i], type)) {
 			error(
 				1, 
 				"Argument %d for %s expected %s, found %s", 
 				i, 
 				call.name, 
 				type_as_string(info.args[i]),
-				type_as_string(type)
+				infer_str(type)
 			);
 				
 		}
@@ -299,27 +412,22 @@ type_t type_of_call(type_list_t *types, ast_call_t call) {
 	return info.ret;
 }
 
-type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
+type_t type_of_expr(scope_t *types, ast_expr_t expr) {
 	type_t expr_type;
 
 	switch (expr.kind) {
 		case AST_EXPR_SYMBOL:
-			expr_type = types_get(*types, expr.symbol_val);
+			expr_type = scope_get(types, expr.symbol_val);
 			log_trace("Symbol %s is type %s", expr.symbol_val, type_as_string(expr_type));
 			break;
-		case AST_EXPR_STRING: {
-			type_t t;
-			t.kind = TYPE_POINTER;
-			t.child = malloc(sizeof(type_t));
-			*t.child = type_kind(TYPE_U8);
-			expr_type = t;
+		case AST_EXPR_STRING:
+			expr_type = type_ptr(type_kind(TYPE_U8));
 			break;
-		}
 		case AST_EXPR_INTEGER:
-			expr_type = type_kind(TYPE_INTEGER);
+			expr_type = infer_var(TYPE_INTEGER);
 			break;
 		case AST_EXPR_FLOAT:
-			TODO("Implement floating point values");
+			expr_type = infer_var(TYPE_FLOAT);
 			break;
 		case AST_EXPR_BOOL:
 			expr_type = type_kind(TYPE_BOOL);
@@ -331,7 +439,7 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 		}
 
 		case AST_EXPR_CAST: {
-			type_t from = type_of_expr(types, *expr.cast.from);
+			type_t from = infer_view(type_of_expr(types, *expr.cast.from));
 			if (!type_casts(expr.cast.to, from))
 				error(1, "Cannot cast from type %s to type %s", type_as_string(from), type_as_string(expr.cast.to));
 			expr_type = expr.cast.to;
@@ -345,26 +453,16 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 			for (size_t i = 1; i < buffer_len(expr.array); i++) {
 				type_t typei = type_of_expr(types, expr.array[i]);
 
-				char *symb = NULL;
-				if (expr.array[i].kind == AST_EXPR_SYMBOL)
-					symb = expr.array[i].symbol_val;
-				
-				if (!type_coerces(typei, type1, types, symb))
-					error(1, "Item %ld of array expected '%s', found '%s'", i, type_as_string(type1), type_as_string(typei));
+				if (!infer_unify(type1, typei))
+					error(1, "Item %ld of array expected '%s', found '%s'", i, infer_str(type1), infer_str(typei));
 			}
 
-			type_t arr;
-			arr.kind = TYPE_ARRAY;
-			arr.count = buffer_len(expr.array);
-			arr.child = malloc(sizeof(type_t));
-			*arr.child = type1;
-
-			expr_type = arr;
+			expr_type = type_array(type1, buffer_len(expr.array));
 			break;
 		}
 
 		case AST_EXPR_GET: {
-			type_t ptr = type_of_expr(types, *expr.get.ptr);
+			type_t ptr = infer_view(type_of_expr(types, *expr.get.ptr));
 
         		if (ptr.kind != TYPE_POINTER)
 				error(1, "Get expects pointer, found %s", type_as_string(ptr));
@@ -375,7 +473,7 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 
 
 		case AST_EXPR_REF: {
-			type_t var = types_get(*types, expr.ref.var);
+			type_t var = scope_get(types, expr.ref.var);
 
 			if (var.kind == TYPE_VOID)
 				error(1, "Variable %s not found", expr.ref.var);
@@ -385,11 +483,11 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 		}
 
 		case AST_EXPR_AREF: {
-			type_t array = type_of_expr(types, *expr.aref.array);
-			type_t index = type_of_expr(types, *expr.aref.index);
+			type_t array = infer_view(type_of_expr(types, *expr.aref.array));
+			type_t index = infer_view(type_of_expr(types, *expr.aref.index));
 
 			if (array.kind != TYPE_ARRAY)
-				error(1, "Aref expects Array, found %s", type_as_string(array));
+				error(1, "Aref expects Array, found %s", infer_str(array));
 
 			if (!is_integer(index))
 				error(1, "Aref expects integer index, found %s", type_as_string(index));
@@ -401,17 +499,12 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 		case AST_EXPR_UNIOP:
 			switch (expr.unop.kind) {
 				case AST_UNOP_NOT: {}
-					ast_expr_t arg = *expr.unop.arg;
-					type_t type = type_of_expr(types, arg);
+					type_t type = type_of_expr(types, *expr.unop.arg);
 
-					char *symb = NULL;
-					if (arg.kind == AST_EXPR_SYMBOL)
-						symb = expr.symbol_val;
-					
-					if (!type_coerces(type, type_kind(TYPE_BOOL), types, symb))
-						error(1, "not expects Bool, found %s", type_as_string(type));
+					if (!infer_unify(type, type_kind(TYPE_BOOL)))
+						error(1, "not expects Bool, found %s", infer_str(type));
 
-					expr_type = type;
+					expr_type = type_kind(TYPE_BOOL);
 					
 					break;
 			}
@@ -419,20 +512,10 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 			break;
 
 		case AST_EXPR_BINOP: {}
-			ast_expr_t lhs_expr = *expr.binop.args[0];
-			ast_expr_t rhs_expr = *expr.binop.args[1];
-			type_t lhs = type_of_expr(types, lhs_expr);
-			type_t rhs = type_of_expr(types, lhs_expr);
-
-			char *lhs_symb = NULL;
-			char *rhs_symb = NULL;
+			type_t lhs = type_of_expr(types, *expr.binop.args[0]);
+			type_t rhs = type_of_expr(types, *expr.binop.args[1]);
 
-			if (lhs_expr.kind == AST_EXPR_SYMBOL)
-				lhs_symb = lhs_expr.symbol_val;
-			if (rhs_expr.kind == AST_EXPR_SYMBOL)
-				rhs_symb = rhs_expr.symbol_val;
-
-			if (!type_coerces(lhs, rhs, types, lhs_symb) or !type_coerces(rhs, lhs, types, rhs_symb))
+			if (!infer_unify(lhs, rhs))
 				error(1, "Operands to binary expression must be of the same type");
 
 			switch (expr.binop.kind) {
@@ -440,11 +523,14 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 				case AST_BINOP_SUB:
 				case AST_BINOP_MUL:
 				case AST_BINOP_DIV:
+					if (!is_numeric(infer_view(lhs)))
+						error(1, "Arithmetic operator expected number, found %s", infer_str(lhs));
+					expr_type = lhs;
+					break;
+
 				case AST_BINOP_MOD:
-					if (!is_integer(lhs))
-						error(1, "Arithmetic operator expected Integer, found %s", type_as_string(lhs));
-					if (!is_integer(rhs))
-						error(1, "Arithmetic operator expected Integer, found %s", type_as_string(rhs));
+					if (!is_integer(infer_view(lhs)))
+						error(1, "Arithmetic operator expected Integer, found %s", infer_str(lhs));
 					expr_type = lhs;
 					break;
 
@@ -455,18 +541,12 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 				case AST_BINOP_LTEQ:
 				case AST_BINOP_GTEQ:
 					expr_type = type_kind(TYPE_BOOL);
-
-					if (!type_coerces(lhs, rhs, types, lhs_symb) and !type_coerces(rhs, lhs, types, lhs_symb))
-						error(1, "Comparison operator must be applied on equal types");
-					
 					break;
 
 				case AST_BINOP_AND:
 				case AST_BINOP_OR:
-					if (!type_coerces(lhs, type_kind(TYPE_BOOL), types, lhs_symb))
-						error(1, "Boolean operator expected Bool, found %s", type_as_string(lhs));
-					if (!type_coerces(rhs, type_kind(TYPE_BOOL), types, lhs_symb))
-						error(1, "Boolean operator expected Bool, found %s", type_as_string(rhs));
+					if (!infer_unify(lhs, type_kind(TYPE_BOOL)))
+						error(1, "Boolean operator expected Bool, found %s", infer_str(lhs));
 
 					expr_type = type_kind(TYPE_BOOL);
 					break;
@@ -475,128 +555,218 @@ type_t type_of_expr(type_list_t *types, ast_expr_t expr) {
 			break;
 	}
 
-	def_type(expr_type);
+	// Types still being inferred are defined once they're known
+	if (infer_has_vars(expr_type))
+		buffer_push(infer.slots, expr.type);
+	else
+		def_type(expr_type);
 
         *expr.type = expr_type;
 	return expr_type;
 }
 
-void check_body(type_t ret, type_list_t types, buffer_t(ast_statement_t) body) {
-	type_list_t ty = types_clone(types);
+void check_body(type_t ret, scope_t *ty, buffer_t(ast_statement_t) body) {
+	scope_push(ty);
 
 	for (size_t i = 0; i < buffer_len(body); i++) {
 		ast_statement_t st = body[i];
 
 		switch (st.kind) {
 			case AST_STATEMENT_DECL: {}
-				type_t exists = types_get(ty, st.decl.name);
+				type_t exists = scope_get(ty, st.decl.name);
 				if (exists.kind != TYPE_VOID)
 					error(1, "Attempted to redeclare variable %s", st.decl.name);
 				
-				types_add(&ty, st.decl.name, st.decl.type);
+				scope_add(ty, st.decl.name, st.decl.type);
 				log_trace("Declaration type: %s", type_as_string(st.decl.type));
 				def_type(st.decl.type);
 				break;
 
 			case AST_STATEMENT_SET: {}
-				type_t type_var = types_get(ty, st.set.name);
+				type_t type_var = scope_get(ty, st.set.name);
 
-				type_t type_exp = type_of_expr(&ty, st.set.val);
+				type_t type_exp = type_of_expr(ty, st.set.val);
 
 				log_trace("Variable %s is type %s", st.set.name, type_as_string(type_var));
 
-				if (!type_coerces(type_var, type_exp, &ty, st.set.name))
-					error(1, "Variable %s is of type %s, found %s", st.set.name, type_as_string(type_var), type_as_string(type_exp));
-				else 
-					*st.set.val.type = type_var;
+				if (!infer_unify(type_var, type_exp))
+					error(1, "Variable %s is of type %s, found %s", st.set.name, infer_str(type_var), infer_str(type_exp));
 
 				break;
 
 			case AST_STATEMENT_LET: {
-				type_t exists = types_get(ty, st.let.name);
+				type_t exists = scope_get(ty, st.let.name);
 				//type_t exists;
 				if (exists.kind != TYPE_VOID)
 					error(1, "Attempted to redeclare variable %s", st.let.name);
 
-				type_t expr = type_of_expr(&ty, st.let.val);
-				types_add(&ty, st.let.name, expr);
+				type_t expr = type_of_expr(ty, st.let.val);
+				scope_add(ty, st.let.name, expr);
 				log_trace("Let type: %s", type_as_string(expr));
-				def_type(expr);
+
+				if (infer_has_vars(expr))
+					buffer_push(infer.lets, ((infer_let_t){ st.let.name, st.let.val.type }));
+
 				break;
 			}
 
 			case AST_STATEMENT_CFLOW: {
-				type_t type_flw = type_of_expr(&ty, st.cflow.cond);
-
-				char *symb = NULL;
-				if (st.cflow.cond.kind == AST_EXPR_SYMBOL)
-					symb = st.cflow.cond.symbol_val;
+				type_t type_flw = type_of_expr(ty, st.cflow.cond);
 
-				if (!type_coerces(type_flw, type_kind(TYPE_BOOL), &ty, symb))
-					error(1, "Control flow condition expected bool, found %s", type_as_string(type_flw));
+				if (!infer_unify(type_flw, type_kind(TYPE_BOOL)))
+					error(1, "Control flow condition expected bool, found %s", infer_str(type_flw));
 
 				check_body(ret, ty, st.cflow.body);
 				break;
 			}
 
 			case AST_STATEMENT_STORE: {
-				type_t ptr = type_of_expr(&ty, st.store.ptr);
-				type_t val = type_of_expr(&ty, st.store.val);
-
-				char *symb = NULL;
-				if (st.store.val.kind == AST_EXPR_SYMBOL)
-					symb = st.store.val.symbol_val;
+				type_t ptr = infer_view(type_of_expr(ty, st.store.ptr));
+				type_t val = type_of_expr(ty, st.store.val);
 
 				if (ptr.kind != TYPE_POINTER)
 					error(1, "Store expects pointer, found %s", type_as_string(ptr));
 
-				if (!type_coerces(*ptr.child, val, &ty, symb))
-					error(1, "Store expected %s, found %s", type_as_string(*ptr.child), type_as_string(val));
+				if (!infer_unify(*ptr.child, val))
+					error(1, "Store expected %s, found %s", infer_str(*ptr.child), infer_str(val));
 
 				break;
 			}
 
 			case AST_STATEMENT_RETURN: {
-				type_t type_ret = type_of_expr(&ty, st.ret);
-
-				char *symb = NULL;
-				if (st.ret.kind == AST_EXPR_SYMBOL)
-					symb = st.ret.symbol_val;
+				type_t type_ret = type_of_expr(ty, st.ret);
 
-				if (!type_coerces(ret, type_ret, &ty, symb))
-					error(1, "Expected return type %s, found %s", type_as_string(ret), type_as_string(type_ret));
+				if (!infer_unify(ret, type_ret))
+					error(1, "Expected return type %s, found %s", type_as_string(ret), infer_str(type_ret));
 
 				break;
 			}
 
 			case AST_STATEMENT_CALL: 
-				type_of_call(&ty, st.call);
+				type_of_call(ty, st.call);
 				break;
 		}
 	}
 
-	for (size_t i = 0; i < buffer_len(body); i++) {
-		ast_statement_t st = body[i];
+	scope_pop(ty);
+}
 
-		if (st.kind == AST_STATEMENT_LET and is_partial(*st.let.val.type)) {
-			type_t type = types_get(ty, st.let.name);
+// Replace the variables in a checked function's types by what they were
+// inferred to be. Literals nothing was learned about keep a partial type,
+// let statements need to know theirs.
+void infer_solve() {
+	for (size_t i = 0; i < buffer_len(infer.slots); i++) {
+		*infer.slots[i] = infer_resolve(*infer.slots[i]);
+		def_type(*infer.slots[i]);
+	}
+
+	for (size_t i = 0; i < buffer_len(infer.lets); i++) {
+		infer_let_t let = infer.lets[i];
 
-			if (type.kind == TYPE_VOID)
-				error(1, "Internal compiler error: variable %s has type TYPE_VOID", st.let.name);
+		if (is_partial(*let.type))
+			error(1, "Not enough info to infer type of variable %s", let.name);
 
-			if (is_partial(type))
-				error(1, "Not enough info to infer type of variable %s", st.let.name);
+		log_trace("Inferred type %s for variable %s", type_as_string(*let.type), let.name);
+	}
+}
 
-			log_trace("Inferred type %s for variable %s", type_as_string(type), st.let.name);
+// Forget the variables of the last function checked
+void infer_reset() {
+	if (infer.vars != NULL)
+		buffer__hdr(infer.vars)->len = 0;
+	if (infer.slots != NULL)
+		buffer__hdr(infer.slots)->len = 0;
+	if (infer.lets != NULL)
+		buffer__hdr(infer.lets)->len = 0;
+}
+
+void infer_free() {
+	buffer_free(infer.vars);
+	buffer_free(infer.slots);
+	buffer_free(infer.lets);
+}
 
-			*st.let.val.type = type;
+// Outcome of checking one function, kept until every function is checked
+typedef struct check_result {
+	buffer_t(type_t *) defs;
+	// Message of the error that stopped checking the function, if any
+	char *error;
+} check_result_t;
+
+typedef struct check_worker {
+	ast_program_t program;
+	check_result_t *results;
+	// Index of the next item to be checked and of the first item with an
+	// error found yet, shared by all workers
+	_Atomic size_t *next;
+	_Atomic size_t *first_error;
+} check_worker_t;
+
+// Check a function in an empty scope, which is left empty again unless an
+// error stopped the check halfway
+void check_func(ast_func_t func, scope_t *scope, check_result_t *result) {
+	jmp_buf *outer = error_trap;
+	jmp_buf trap;
+
+	if (setjmp(trap) == 0) {
+		error_trap = &trap;
+		infer_reset();
+		scope_push(scope);
+
+		for (size_t i = 0; i < buffer_len(func.args); i++)
+			scope_add(scope, func.args[i].name, func.args[i].type);
+
+		check_body(func.ret, scope, func.body);
+		infer_solve();
+		scope_pop(scope);
+	} else {
+		result->error = error_message;
+	}
+
+	error_trap = outer;
+
+	result->defs = def_queue;
+	def_queue = NULL;
+}
+
+// Check functions until there are none left, taking the next one each time
+void *check_worker(void *arg) {
+	check_worker_t *worker = arg;
+	scope_t scope = { 0 };
+
+	for (;;) {
+		size_t i = atomic_fetch_add(worker->next, 1);
+
+		if (i >= buffer_len(worker->program.items))
+			break;
+
+		if (worker->program.items[i].kind != AST_TL_FUNC or i > atomic_load(worker->first_error))
+			continue;
+
+		check_func(worker->program.items[i].func, &scope, worker->results + i);
+
+		// Functions after an error are never reported on, so they're skipped.
+		// The ones before still have to be checked, as they may fail first.
+		if (worker->results[i].error != NULL) {
+			size_t first = atomic_load(worker->first_error);
+
+			while (i < first and !atomic_compare_exchange_weak(worker->first_error, &first, i));
+
+			scope_free(&scope);
 		}
 	}
+
+	scope_free(&scope);
+	infer_free();
+	return NULL;
 }
 
-void type_check(ast_program_t program) {
+// Type check a program, with function bodies checked on up to threads
+// threads. They only read the signatures registered before, so each can be
+// checked on its own. Errors and definitions are collected per function and
+// handled in source order, as if the program had been checked serially.
+void type_check_parallel(ast_program_t program, size_t threads) {
 	log_info("Begin type checking");
-	type_list_t types = NULL;
 	
 	for (size_t i = 0; i < buffer_len(program.items); i++) {
 		ast_tl_t tl = program.items[i];
@@ -609,15 +779,38 @@ void type_check(ast_program_t program) {
 		}
 	}
 
-	for (size_t i = 0; i < buffer_len(program.items); i++) {
+	size_t items = buffer_len(program.items);
+
+	if (threads > items)
+		threads = MAX(1, items);
+
+	check_result_t *results = calloc(MAX(1, items), sizeof(check_result_t));
+	_Atomic size_t next = 0;
+	_Atomic size_t first_error = SIZE_MAX;
+	check_worker_t worker = { program, results, &next, &first_error };
+
+	// The calling thread checks alongside the others
+	pthread_t ids[threads];
+
+	for (size_t t = 1; t < threads; t++)
+		if (pthread_create(ids + t, NULL, check_worker, &worker) != 0)
+			error(1, "Failed to start type checker thread");
+
+	check_worker(&worker);
+
+	for (size_t t = 1; t < threads; t++)
+		pthread_join(ids[t], NULL);
+
+	for (size_t i = 0; i < items; i++) {
 		ast_tl_t tl = program.items[i];
 
 		switch (tl.kind) {
 			case AST_TL_FUNC:
-				for (size_t i = 0; i < buffer_len(tl.func.args); i++)
-					types_add(&types, tl.func.args[i].name, tl.func.args[i].type);
+				if (results[i].error != NULL)
+					error(1, "%s", results[i].error);
 
-				check_body(tl.func.ret, types, tl.func.body);
+				def_flush(results[i].defs);
+				buffer_free(results[i].defs);
 				break;
 
 			case AST_TL_RECORD:
@@ -626,16 +819,342 @@ void type_check(ast_program_t program) {
 				for (size_t i = 0; i < buffer_len(tl.record.fields); i++)
 					def_type(tl.record.fields[i].type);
 
+				def_flush(def_queue);
+				buffer_free(def_queue);
 				break;
 
 			default: break;
 		}
 	}
 
-	assert(!type_coerces(type_kind(TYPE_U8), type_kind(TYPE_I32)));
+	free(results);
+
+	assert(!infer_unify(type_kind(TYPE_U8), type_kind(TYPE_I32)));
 
 	assert(is_partial(type_kind(TYPE_INTEGER)));
 	assert(!is_partial(type_kind(TYPE_I64)));
 
 	log_info("End type checking");
 }
+
+void type_check(ast_program_t program) {
+	type_check_parallel(program, 1);
+}
+
+// Variables leave with their scope, and arguments with their function
+test_result_t scope_test() {
+	scope_t scope = { 0 };
+	char *a = intern_str("a");
+	char *b = intern_str("b");
+
+	scope_push(&scope);
+	scope_add(&scope, a, type_kind(TYPE_I64));
+	scope_push(&scope);
+	scope_add(&scope, b, type_kind(TYPE_U8));
+	scope_add(&scope, a, type_kind(TYPE_U8));
+
+	if (scope_get(&scope, a).kind != TYPE_I64 or scope_get(&scope, b).kind != TYPE_U8)
+		return test_fail("Wrong types in the inner scope");
+
+	scope_pop(&scope);
+
+	if (scope_getp(&scope, b) != NULL or scope_get(&scope, a).kind != TYPE_I64)
+		return test_fail("Inner variable outlived its scope");
+
+	scope_pop(&scope);
+
+	if (scope_getp(&scope, a) != NULL)
+		return test_fail("Outer variable outlived its scope");
+
+	scope_free(&scope);
+
+	// The same argument name with different types in two functions
+	char *source =
+		"(func f [ (a I64) ] I64 { (if true { (let b a) (return b) }) (return a) })\n"
+		"(func g [ (a (@ U8)) ] (@ U8) { (let b a) (return b) })\n";
+
+	type_check(ast_parse_source(source, strlen(source)));
+	return test_pass();
+}
+
+// A function with vars variables in its body and depth nested ifs below
+// them, each adding one more
+char *scope_bench_source(size_t vars, size_t depth, size_t *len) {
+	strbuf_t sb = { 0 };
+
+	strbuf_push(&sb, "(func main [] I64 {\n");
+
+	for (size_t i = 0; i < vars; i++)
+		strbuf_fmt(&sb, "(let v%zu (cast %zu I64))\n", i, i);
+
+	for (size_t i = 0; i < depth; i++)
+		strbuf_fmt(&sb, "(if true { (let n%zu (+ v%zu 1))\n", i, i % vars);
+
+	strbuf_push(&sb, "(return 0)");
+
+	for (size_t i = 0; i < depth; i++)
+		strbuf_push(&sb, "})");
+
+	strbuf_push(&sb, "\n(return 0) })\n");
+
+	*len = strbuf_len(&sb);
+	return sb.chars;
+}
+
+// Type checking time of deeply nested bodies under many variables
+void scope_bench() {
+	intern_free();
+	symbols_init();
+
+	size_t sizes[][2] = { { 100, 100 }, { 1000, 1000 }, { 5000, 5000 } };
+
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(*sizes); i++) {
+		size_t len;
+		char *source = scope_bench_source(sizes[i][0], sizes[i][1], &len);
+		ast_program_t prog = ast_parse_source(source, len);
+
+		uint64_t start = bench_now();
+		type_check(prog);
+		uint64_t elapsed = bench_now() - start;
+
+		printf("%5zu vars, depth %5zu: %8.2f ms\n", sizes[i][0], sizes[i][1], (double)elapsed / 1e6);
+		buffer_free(source);
+	}
+}
+
+// count functions using array types of a few shapes, those at the indices in
+// failing don't type check
+char *check_mt_source(size_t count, size_t *failing, size_t failures) {
+	strbuf_t sb = { 0 };
+
+	for (size_t i = 0; i < count; i++) {
+		bool fails = false;
+
+		for (size_t j = 0; j < failures; j++)
+			fails = fails or failing[j] == i;
+
+		strbuf_fmt(
+			&sb,
+			"(func mt_f%zu [ (a I64) ] I64 {\n"
+			"\t(decl x (Array (Array U8 %zu) %zu))\n"
+			"\t(let y (array a a a))\n"
+			"\t(if (< a %zu) { (return %s) })\n"
+			"\t(return (+ a (get (aref y 1))))\n"
+			"})\n",
+			i, i % 3 + 1, i % 5 + 1, i, fails ? "\"fail\"" : "a"
+		);
+	}
+
+	return sb.chars;
+}
+
+// Type check a source on a number of threads, giving the array definitions
+// made and the error reported, if any
+buffer_t(char *) check_mt_run(char *source, size_t threads, char **error) {
+	ast_program_t prog = ast_parse_source(source, strlen(source));
+	jmp_buf trap;
+
+	buffer_free(defs);
+	def_set_free(&def_hashes);
+	*error = NULL;
+
+	if (setjmp(trap) == 0) {
+		error_trap = &trap;
+		type_check_parallel(prog, threads);
+	} else {
+		*error = error_message;
+	}
+
+	error_trap = NULL;
+
+	buffer_t(char *) made = defs;
+	defs = NULL;
+	def_set_free(&def_hashes);
+	return made;
+}
+
+// Checking on several threads must define the same types in the same order,
+// and report the same error, as checking serially
+test_result_t type_check_mt_test() {
+	size_t failing[] = { 150, 40, 170 };
+	char *sources[] = {
+		check_mt_source(200, NULL, 0),
+		check_mt_source(200, failing, 3),
+	};
+
+	for (size_t s = 0; s < sizeof(sources)/sizeof(*sources); s++) {
+		char *expect_error;
+		buffer_t(char *) expect = check_mt_run(sources[s], 1, &expect_error);
+
+		if ((s == 1) != (expect_error != NULL))
+			return test_fail("Source %zu: serial check gave error '%s'", s, expect_error);
+
+		for (size_t threads = 2; threads <= 8; threads *= 2) {
+			char *error;
+			buffer_t(char *) made = check_mt_run(sources[s], threads, &error);
+
+			if ((error == NULL) != (expect_error == NULL) or (error != NULL and strcmp(error, expect_error) != 0))
+				return test_fail("Source %zu on %zu threads: error '%s', expected '%s'", s, threads, error, expect_error);
+
+			if (buffer_len(made) != buffer_len(expect))
+				return test_fail("Source %zu on %zu threads: %zu definitions, expected %zu", s, threads, buffer_len(made), buffer_len(expect));
+
+			for (size_t i = 0; i < buffer_len(made); i++)
+				if (strcmp(made[i], expect[i]) != 0)
+					return test_fail("Source %zu on %zu threads: definition %zu differs", s, threads, i);
+
+			buffer_free(made);
+		}
+
+		buffer_free(expect);
+		buffer_free(sources[s]);
+	}
+
+	return test_pass();
+}
+
+// Type checking time of many functions by number of threads
+void type_check_bench() {
+	intern_free();
+	symbols_init();
+
+	char *source = check_mt_source(40000, NULL, 0);
+	ast_program_t prog = ast_parse_source(source, strlen(source));
+	uint64_t serial = 0;
+
+	for (size_t threads = 1; threads <= 16; threads *= 2) {
+		buffer_free(defs);
+		def_set_free(&def_hashes);
+
+		uint64_t start = bench_now();
+		type_check_parallel(prog, threads);
+		uint64_t elapsed = bench_now() - start;
+
+		if (threads == 1)
+			serial = elapsed;
+
+		printf(
+			"check %2zu threads: %8.1f ms, %5.2fx\n",
+			threads, (double)elapsed / 1e6, (double)serial / (double)elapsed
+		);
+	}
+
+	buffer_free(source);
+}
+
+// Type check a source, giving the error reported if any
+ast_program_t infer_check_source(char *source, char **error) {
+	ast_program_t prog = ast_parse_source(source, strlen(source));
+	jmp_buf trap;
+
+	*error = NULL;
+
+	if (setjmp(trap) == 0) {
+		error_trap = &trap;
+		type_check(prog);
+	} else {
+		*error = error_message;
+	}
+
+	error_trap = NULL;
+	return prog;
+}
+
+// Types of literals and lets come from their uses, wherever those are
+test_result_t infer_test() {
+	struct {
+		char *source;
+		// Type of the let in the first statement of the first function
+		char *let;
+	} cases[] = {
+		// Inferred from a nested body
+		{ "(func inf_a [] U8 { (let x 0) (if true { (let y x) (return y) }) (return 0) })", "U8" },
+		// Through a chain of lets, in either order of use
+		{ "(func inf_b [] I16 { (let a 1) (let b a) (let c (+ 2 b)) (return c) })", "I16" },
+		{ "(func inf_c [ (p I16) ] I16 { (let a 1) (let b (+ a 2)) (set p b) (return p) })", "I16" },
+		// Float literals make the whole class a float
+		{ "(func inf_d [] F32 { (let f 1) (let g (+ f 2.5)) (return g) })", "F32" },
+		// Arrays of literals, and literals after a typed item
+		{ "(func inf_e [] I32 { (let v (array 1 2 3)) (return (get (aref v 0))) })", "(Array I32 3)" },
+		{ "(func inf_f [ (a I64) ] I64 { (let v (array a 2 3)) (return (get (aref v 0))) })", "(Array I64 3)" },
+		{ "(func inf_g [] I64 { (let v (array 1 2)) (let w (array v (array 3 4))) (return (get (aref v 1))) })", "(Array I64 2)" },
+	};
+
+	for (size_t i = 0; i < sizeof(cases)/sizeof(*cases); i++) {
+		char *error;
+		ast_program_t prog = infer_check_source(cases[i].source, &error);
+
+		if (error != NULL)
+			return test_fail("Case %zu failed to check: %s", i, error);
+
+		type_t let = *prog.items[0].func.body[0].let.val.type;
+
+		if (strcmp(type_as_string(let), cases[i].let) != 0)
+			return test_fail("Case %zu inferred %s, expected %s", i, type_as_string(let), cases[i].let);
+	}
+
+	char *failing[][2] = {
+		{ "(func inf_h [] I64 { (let x 5) (return 0) })", "Not enough info to infer type of variable x" },
+		{ "(func inf_i [] I64 { (return 1.5) })", "Expected return type I64, found {Float}" },
+		{ "(func inf_j [] I64 { (let x 1) (if true { (let y (+ x 0.5)) }) (return x) })", "Expected return type I64, found {Float}" },
+	};
+
+	for (size_t i = 0; i < sizeof(failing)/sizeof(*failing); i++) {
+		char *error;
+		infer_check_source(failing[i][0], &error);
+
+		if (error == NULL or strcmp(error, failing[i][1]) != 0)
+			return test_fail("Failing case %zu gave error '%s', expected '%s'", i, error, failing[i][1]);
+	}
+
+	return test_pass();
+}
+
+// A function inferring the type of a chain of lets lets long from its return
+char *infer_bench_source(size_t lets, size_t *len) {
+	strbuf_t sb = { 0 };
+
+	strbuf_push(&sb, "(func main [] I64 {\n(let v0 0)\n");
+
+	for (size_t i = 1; i < lets; i++)
+		strbuf_fmt(&sb, "(let v%zu (+ v%zu %zu))\n", i, i - 1, i);
+
+	strbuf_fmt(&sb, "(return v%zu) })\n", lets - 1);
+
+	*len = strbuf_len(&sb);
+	return sb.chars;
+}
+
+// Type checking time of let chains resolved only at their end
+void infer_bench() {
+	intern_free();
+	symbols_init();
+
+	for (size_t lets = 1000; lets <= 1000000; lets *= 10) {
+		size_t len;
+		char *source = infer_bench_source(lets, &len);
+		ast_program_t prog = ast_parse_source(source, len);
+
+		uint64_t start = bench_now();
+		type_check(prog);
+		uint64_t elapsed = bench_now() - start;
+
+		printf("%8zu lets: %8.2f ms, %6.1f ns/let\n", lets, (double)elapsed / 1e6, (double)elapsed / (double)lets);
+		buffer_free(source);
+	}
+}
+
+// A record defined twice is reported by name
+test_result_t record_dup_test() {
+	char *error;
+	infer_check_source(
+		"(record Dup [ (a I64) ])\n"
+		"(record Dup [ (b I64) ])\n",
+		&error
+	);
+
+	if (error == NULL or strcmp(error, "Record Dup already defined") != 0)
+		return test_fail("Duplicate record gave error '%s'", error);
+
+	return test_pass();
+}